@@ -1,481 +1,450 @@
 #include "dnadb.h" 
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
 
 // DnaDb constructor to initialize our hash table
-DnaDb::DnaDb(int size, hash_fn hash, prob_t probing = DEFPOLCY){
-    m_currentCap = size;
-
-    // Ensure the initial capacity is within the valid prime range
-    if(m_currentCap < MINPRIME)
-        m_currentCap = MINPRIME;
-    else if(m_currentCap > MAXPRIME)
-        m_currentCap = MAXPRIME;
-    else{
-        // If not prime, find the next prime number for capacity
-        if(!isPrime(m_currentCap)){
-            m_currentCap = findNextPrime(m_currentCap);
-        }
-    }
-
-    
-    m_hash = hash;
-    // Set the initial probing policy for collision resolution
-    m_currProbing = probing;
-    // Dynamically allocate memory for the current hash table array
-    m_currentTable = new DNA*[m_currentCap];
-    // Initialize all pointers in the new table to nullptr
-    for(int i=0; i< m_currentCap; i++){
-        m_currentTable[i] = nullptr;
-    }
+DnaDb::DnaDb(int size, hash_fn hash, prob_t probing = DEFPOLCY, key_mode_t mode)
+    : Table(size, HashFnRef(hash), probing), m_keyMode(mode), m_changeSink(nullptr){
+}
 
-    // Initialize all other member variables related to table state and rehashing
-    m_currentSize = 0; // Number of active elements in the current table
-    m_currNumDeleted = 0; // Number of deleted elements in the current table
-    m_transferIndex = 0; // Tracks progress of incremental rehash
-    m_newPolicy = probing; // Stores the policy for the next rehash
-    m_oldTable = nullptr; // Pointer to the old table during rehashing
-    m_oldCap = 0; // Capacity of the old table
-    m_oldSize = 0; // Size of the old table
-    m_oldNumDeleted = 0; // Number of deleted items in the old table
-    m_oldProbing = probing; // Probing policy of the old table
+// Inserts a DNA object into the hash table
+bool DnaDb::insert(DNA dna){
+    // Compute the hash value of the key and hand over to the shared insert path
+    string scratch;
+    const string& key = keyOf(dna.m_sequence, scratch);
+    return insertHashed(key, dna.m_location, getHash()(key));
 }
 
-// Destructor to properly deallocate all dynamically allocated memory
-DnaDb::~DnaDb(){
-    // Delete all DNA objects and then the array for the current table
-    if (m_currentTable){
-        for(int i=0; i<m_currentCap; i++){
-            delete m_currentTable[i];
-        }
-        delete[] m_currentTable;
-    }
-    
-    // Delete all DNA objects and then the array for the old table, if it exists
-    if (m_oldTable){
-        for(int i=0; i<m_oldCap; i++){
-            delete m_oldTable[i];
-        }
-        delete[] m_oldTable;
+// Inserts a batch of DNA objects, returns the number actually inserted
+int DnaDb::insertBatch(const vector<DNA>& batch){
+    int inserted = 0;
+    string scratch;
+    for (size_t i = 0; i < batch.size(); i++){
+        const string& key = keyOf(batch[i].m_sequence, scratch);
+        if (insertHashed(key, batch[i].m_location, getHash()(key)))
+            inserted++;
     }
+    return inserted;
 }
 
-// Allows changing the probing policy for future rehashes
-void DnaDb::changeProbPolicy(prob_t policy){
-    m_newPolicy = policy;
+// Inserts a batch whose hash values were already computed with this table's hash function
+int DnaDb::insertBatch(const vector<DNA>& batch, const vector<unsigned int>& hashes){
+    int inserted = 0;
+    for (size_t i = 0; i < batch.size() && i < hashes.size(); i++){
+        if (insertHashed(batch[i].m_sequence, batch[i].m_location, hashes[i]))
+            inserted++;
+    }
+    return inserted;
 }
 
-// Inserts a DNA object into the hash table
-bool DnaDb::insert(DNA dna){
+// Inserts a key using a precomputed hash value
+bool DnaDb::insertHashed(const string& key, int location, unsigned int hashValue){
     // Return false if the location ID is out of bounds
-    if (dna.getLocId() < MINLOCID || dna.getLocId() > MAXLOCID){
+    if (location < MINLOCID || location > MAXLOCID){
         return false;
     }
+    // The same sequence may be stored at other locations
+    if (!Table::insertHashed(key, location, hashValue, [location](int stored){return stored == location;}))
+        return false;
+    if (m_changeSink != nullptr)
+        m_changeSink->onChange(CHANGE_INSERT, key, location, location);
+    return true;
+}
 
-    // Compute the hash value and initial index for the DNA object
-    unsigned int hashValue = m_hash(dna.getSequence());
-    int originalIndex = hashValue % m_currentCap;
-    int index = originalIndex;
-
-    // Handle collisions by probing until an empty or deleted slot is found
-    int i = 1;
-    while(m_currentTable[index] != nullptr && m_currentTable[index]->m_used){
-        // If the DNA already exists, return false
-        if (*m_currentTable[index] == dna)
-            return false;
-        
-        // Apply the current probing policy to find the next index
-        switch(m_currProbing){
-            case QUADRATIC: 
-                index = (originalIndex + i*i) % m_currentCap;
-                break;
-            case DOUBLEHASH:
-                {
-                    unsigned int hash2 = 11 - (hashValue % 11); // Second hash function for double hashing
-                    index = (originalIndex + i * hash2) % m_currentCap;
-                    break;
-                }
-            case LINEAR:
-                index = (originalIndex + i) % m_currentCap;
-                break;
-        }
-        i++;
-    }
-    // Insert the new DNA object or overwrite a previously deleted one
-    if (m_currentTable[index] == nullptr){
-        m_currentTable[index] = new DNA(dna);
-    }
-    else{
-        *m_currentTable[index] = dna;
-    }
+// Removes a DNA object from the hash table
+bool DnaDb::remove(DNA dna){
+    int location = dna.m_location;
+    string scratch;
+    const string& key = keyOf(dna.m_sequence, scratch);
+    if (!removeHashed(key, getHash()(key), [location](int stored){return stored == location;}))
+        return false;
+    if (m_changeSink != nullptr)
+        m_changeSink->onChange(CHANGE_REMOVE, key, location, location);
+    return true;
+}
+
+// Retrieves a DNA object based on its sequence and location ID
+const DNA DnaDb::getDNA(string sequence, int location) const{
+    string scratch;
+    const string& key = keyOf(sequence, scratch);
+    const int* found = findHashed(OP_FIND, key, getHash()(key),
+                                  [location](int stored){return stored == location;});
+    if (found != nullptr)
+        return DNA(key, *found, true); // Return the found DNA object
+    // If DNA object is not found in either table, return a default-constructed (empty) DNA object
+    return DNA();
+}
 
-    m_currentTable[index]->m_used = true; // Mark the slot as used
-    m_currentSize++; // Increment the count of active elements
+// Updates the location ID of an existing DNA object
+bool DnaDb::updateLocId(DNA dna, int location){
+    // The location ID is not part of the hash, so the object keeps its bucket
+    int current = dna.m_location;
+    string scratch;
+    const string& key = keyOf(dna.m_sequence, scratch);
+    int* found = findHashed(OP_UPDATE, key, getHash()(key), [current](int stored){return stored == current;});
+    if (found == nullptr)
+        return false; // DNA object not found in either table
+    *found = location;
+    if (m_changeSink != nullptr)
+        m_changeSink->onChange(CHANGE_UPDATE, key, location, current);
+    return true;
+}
 
-    // Check load factor and trigger rehash if necessary
-    if (lambda() > 0.5){
-        rehash(); // Perform a full rehash to a larger table
-        incrementalRehash(); // Start incremental transfer if rehashing is in progress
-    }
-    // If a rehash is already in progress, continue incremental transfer
-    else if (m_oldTable != nullptr){
-        incrementalRehash();
+// Returns the sequence itself, or its reverse complement written to scratch if
+// the mode is CANONICAL and the reverse complement is smaller
+static const string& keyFor(key_mode_t mode, const string& sequence, string& scratch){
+    if (mode == EXACT || isCanonical(sequence.data(), sequence.size()))
+        return sequence;
+    reverseComplement(sequence.data(), sequence.size(), scratch);
+    return scratch;
+}
+
+const string& DnaDb::keyOf(const string& sequence, string& scratch) const{
+    return keyFor(m_keyMode, sequence, scratch);
+}
+
+void DnaDb::canonicalize(DNA& dna) const{
+    if (m_keyMode == CANONICAL && !isCanonical(dna.m_sequence.data(), dna.m_sequence.size())){
+        string complement;
+        reverseComplement(dna.m_sequence.data(), dna.m_sequence.size(), complement);
+        dna.m_sequence.swap(complement);
     }
+}
 
-    return true; 
+// Complement of every character: A<->T, C<->G in both cases, anything else unchanged
+struct ComplementTable{
+    char value[256];
+};
+constexpr ComplementTable makeComplementTable(){
+    ComplementTable table{};
+    for (int c = 0; c < 256; c++) table.value[c] = (char)c;
+    table.value['A'] = 'T'; table.value['T'] = 'A'; table.value['C'] = 'G'; table.value['G'] = 'C';
+    table.value['a'] = 't'; table.value['t'] = 'a'; table.value['c'] = 'g'; table.value['g'] = 'c';
+    return table;
 }
+static constexpr ComplementTable COMPLEMENT = makeComplementTable();
 
-// Removes a DNA object from the hash table
-bool DnaDb::remove(DNA dna){
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "packBases reads 8 letters per load");
+const unsigned long long ONES = 0x0101010101010101ULL;
 
-    // Determine the initial index for the element in the current table
-    unsigned int hashValue = m_hash(dna.getSequence());
-    int originalIndex_curr = hashValue % m_currentCap;
-    int index = originalIndex_curr;
+// 2-bit code of every letter of chunk, taken from bits 1 and 2 of the letter:
+// A=0, C=1, G=2, T=3, so the complement is code ^ 3 and comparing codes compares letters
+static inline unsigned long long codesOf(unsigned long long chunk){
+    return ((chunk >> 1) ^ (chunk >> 2)) & (3 * ONES);
+}
+// The letters of 8 codes: 'A' + {0, 2, 6, 19}[code]
+static inline unsigned long long lettersOf(unsigned long long codes){
+    unsigned long long low = codes & ONES, high = (codes >> 1) & ONES;
+    return 'A' * ONES + (low << 1) + 6 * high + 11 * (low & high);
+}
 
-    // Scan the current table to find and mark the DNA as deleted
-    int i = 0;
-    while(i < m_currentCap){ // Iterate through potential slots
-        if (m_currentTable[index] != nullptr && m_currentTable[index]->m_used){
-            if (*m_currentTable[index] == dna){
-                m_currentTable[index]->m_used = false; // Mark as logically deleted
-                m_currNumDeleted++; // Increment deleted count
-                // Trigger rehash if the ratio of deleted elements is too high
-                if((float)m_currNumDeleted > 0.8 * m_currentSize){
-                    rehash();
-                }
-                incrementalRehash(); // Continue incremental rehash if active
-                return true; // DNA object successfully marked for deletion
-            }
-        }
-        // Move to the next index based on current probing policy
-        switch(m_currProbing){
-            case QUADRATIC: 
-                index = (originalIndex_curr + i*i) % m_currentCap;
-                break;
-            case DOUBLEHASH:
-                {
-                    unsigned int hash2 = 11 - (hashValue % 11);
-                    index = (originalIndex_curr + i * hash2) % m_currentCap;
-                    break;
-                }
-            case LINEAR:
-                index = (originalIndex_curr + i) % m_currentCap;
-                break;
-        }
-        i++;
-    }
+// 2-bit codes of the count (1-8) letters in the low bytes of chunk, first letter in
+// the highest bits; valid turns false unless the letters are upper case A, C, G or T
+static inline unsigned long long packChunk(unsigned long long chunk, int count, bool& valid){
+    unsigned long long used = (count == 8) ? ~0ULL : (1ULL << (8 * count)) - 1;
+    unsigned long long codes = codesOf(chunk);
+    valid &= (((chunk ^ lettersOf(codes)) & used) == 0);
+    codes = __builtin_bswap64(codes);
+    codes = (codes | (codes >> 6)) & 0x000F000F000F000FULL;
+    codes = (codes | (codes >> 12)) & 0x000000FF000000FFULL;
+    codes = (codes | (codes >> 24)) & 0xFFFFULL;
+    return codes >> (2 * (8 - count));
+}
 
-    // If not found in the current table, check the old table if a rehash is in progress
-    if(m_oldTable){
-        int originalIndex_old = hashValue % m_oldCap;
-        index = originalIndex_old;
-
-        // Scan the old table to find and mark for deletion
-        int j = 0;
-        while(j < m_oldCap){ // Iterate through potential slots in the old table
-            if (m_oldTable[index] != nullptr && m_oldTable[index]->m_used){
-                if (*m_oldTable[index] == dna){
-                    m_oldTable[index]->m_used = false; // Mark as logically deleted in old table
-                    m_oldNumDeleted++; // Increment old table's deleted count
-                    incrementalRehash(); // Continue incremental rehash
-                    return true; // DNA object successfully marked for deletion
-                }
-            }
-            // Move to the next index based on old probing policy
-            switch(m_oldProbing){
-                case QUADRATIC: 
-                    index = (originalIndex_old + j*j) % m_oldCap;
-                    break;
-                case DOUBLEHASH:
-                    {
-                        unsigned int hash2 = 11 - (hashValue % 11);
-                        index = (originalIndex_old + j * hash2) % m_oldCap;
-                        break;
-                    }
-                case LINEAR:
-                    index = (originalIndex_old + j) % m_oldCap;
-                    break;
-            }
-            j++;
-        }
+// 8 letters at a time while they are A, C, G or T, the rest through the table
+void reverseComplement(const char* seq, size_t length, string& out){
+    out.resize(length);
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8){
+        unsigned long long chunk;
+        memcpy(&chunk, seq + length - i - 8, 8);
+        unsigned long long codes = codesOf(chunk);
+        if (lettersOf(codes) != chunk)
+            break;
+        unsigned long long complement = __builtin_bswap64(lettersOf(codes ^ (3 * ONES)));
+        memcpy(&out[i], &complement, 8);
     }
-    
-    return false; // DNA object not found or not deleted
+    for (; i < length; i++)
+        out[i] = COMPLEMENT.value[(unsigned char)seq[length - 1 - i]];
 }
 
-// Retrieves a DNA object based on its sequence and location ID
-const DNA DnaDb::getDNA(string sequence, int location) const{
-    // Compute the initial index for the sequence in the current table
-    unsigned int hashValue = m_hash(sequence);
-    int originalIndex_curr = hashValue % m_currentCap;
-    int index = originalIndex_curr;
-
-    // Scan the current table for the DNA object
+// Packs up to 32 bases into a word, 8 letters per load; valid turns false on
+// anything that is not an upper case A, C, G or T
+static inline unsigned long long packBases(const char* seq, int length, bool& valid){
+    unsigned long long word = 0;
     int i = 0;
-    while(i < m_currentCap){
-        if (m_currentTable[index] != nullptr && m_currentTable[index]->m_used){
-            // Check if both sequence and location ID match
-            if (m_currentTable[index]->m_location == location && m_currentTable[index]->m_sequence == sequence){
-                return *m_currentTable[index]; // Return the found DNA object
-            }
-        }
-        // Move to the next index based on current probing policy
-        switch(m_currProbing){
-            case QUADRATIC: 
-                index = (originalIndex_curr + i*i) % m_currentCap;
-                break;
-            case DOUBLEHASH:
-                {
-                    unsigned int hash2 = 11 - (hashValue % 11);
-                    index = (originalIndex_curr + i * hash2) % m_currentCap;
-                    break;
-                }
-            case LINEAR:
-                index = (originalIndex_curr + i) % m_currentCap;
-                break;
-        }
-        i++;
+    for (; i + 8 <= length; i += 8){
+        unsigned long long chunk;
+        memcpy(&chunk, seq + i, 8);
+        word = (word << 16) | packChunk(chunk, 8, valid);
+    }
+    if (i < length){
+        unsigned long long chunk = 0;
+        for (int k = length - 1; k >= i; k--)
+            chunk = (chunk << 8) | (unsigned char)seq[k];
+        word = (word << (2 * (length - i))) | packChunk(chunk, length - i, valid);
     }
+    return word;
+}
 
-    // If not found in the current table, check the old table if a rehash is in progress
-    if (m_oldTable){
-        int originalIndex_old = hashValue % m_oldCap;
-        index = originalIndex_old;
-
-        // Scan the old table for the DNA object
-        int j = 0;
-        while(j < m_oldCap){
-            if (m_oldTable[index] != nullptr && m_oldTable[index]->m_used){
-                // Check if both sequence and location ID match
-                if (m_oldTable[index]->m_location == location && m_oldTable[index]->m_sequence == sequence ){
-                    return *m_oldTable[index]; // Return the found DNA object
-                }
-            }
-            // Move to the next index based on old probing policy
-            switch(m_oldProbing){
-                case QUADRATIC: 
-                    index = (originalIndex_old + j*j) % m_oldCap;
-                    break;
-                case DOUBLEHASH:
-                    {
-                        unsigned int hash2 = 11 - (hashValue % 11);
-                        index = (originalIndex_old + j * hash2) % m_oldCap;
-                        break;
-                    }
-                case LINEAR:
-                    index = (originalIndex_old + j) % m_oldCap;
-                    break;
-            }
-            j++;
-        }
+bool packSequence(const char* seq, int length, unsigned long long& word){
+    bool valid = true;
+    word = packBases(seq, length, valid);
+    return valid;
+}
+
+// Complement every code, then reverse the order of the 2-bit groups
+unsigned long long reverseComplementPacked(unsigned long long word, int length){
+    word = ~word;
+    word = ((word >> 2) & 0x3333333333333333ULL) | ((word & 0x3333333333333333ULL) << 2);
+    word = ((word >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((word & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    word = __builtin_bswap64(word);
+    return word >> (64 - 2 * length);
+}
+
+// Compares the sequence with its reverse complement 32 bases at a time, block i of
+// the reverse complement is the reverse complement of block i counted from the end
+bool isCanonical(const char* seq, size_t length){
+    bool valid = true;
+    for (size_t done = 0; done < length; done += 32){
+        int count = (int)min<size_t>(32, length - done);
+        unsigned long long forward = packBases(seq + done, count, valid);
+        unsigned long long reverse = reverseComplementPacked(packBases(seq + length - done - count, count, valid), count);
+        if (!valid)
+            break;
+        if (forward != reverse)
+            return forward < reverse;
     }
-    // If DNA object is not found in either table, return a default-constructed (empty) DNA object
-    return DNA();
+    if (valid)
+        return true; // the sequence is its own reverse complement
+    string complement;
+    reverseComplement(seq, length, complement);
+    return complement.compare(0, length, seq, length) >= 0;
 }
 
-// Updates the location ID of an existing DNA object
-bool DnaDb::updateLocId(DNA dna, int location){
-    // Get initial index for the current table
-    unsigned int hashValue = m_hash(dna.getSequence());
-    int originalIndex_curr = hashValue % m_currentCap;
-    int index = originalIndex_curr;
+bool DnaCursor::next(){
+    if (!m_cursor.next())
+        return false;
+    const DnaDb::Table::Slot& slot = m_cursor.get();
+    m_current.m_sequence = slot.key;
+    m_current.m_location = slot.value;
+    m_current.m_used = true;
+    return true;
+}
 
-    // Scan the current table to find and update the DNA object's location
-    int i = 0;
-    while(i < m_currentCap){
-        if (m_currentTable[index] != nullptr && m_currentTable[index]->m_used){
-            if ( *m_currentTable[index] == dna){ // Check for equality of DNA objects
-                m_currentTable[index]->m_location = location; // Update the location ID
-                return true; // Update successful
-            }
-        }
-        // Move to the next index based on current probing policy
-        switch(m_currProbing){
-            case QUADRATIC: 
-                index = (originalIndex_curr + i*i) % m_currentCap;
-                break;
-            case DOUBLEHASH:
-                {
-                    unsigned int hash2 = 11 - (hashValue % 11);
-                    index = (originalIndex_curr + i * hash2) % m_currentCap;
-                    break;
-                }
-            case LINEAR:
-                index = (originalIndex_curr + i) % m_currentCap;
-                break;
+// Collects output in a large buffer and hands it to write() in big pieces
+class BufferedWriter{
+    public:
+    BufferedWriter(int fd) : m_fd(fd), m_used(0), m_failed(false){
+        m_buffer.resize(EXPORTBUFSIZE);
+    }
+    void put(const void* data, size_t length){
+        if (m_used + length > m_buffer.size())
+            flush();
+        if (length > m_buffer.size()){
+            writeAll((const char*)data, length);
+            return;
         }
-        i++;
+        memcpy(m_buffer.data() + m_used, data, length);
+        m_used += length;
     }
-    // If not found in the current table, check the old table if a rehash is in progress
-    if (m_oldTable){
-        int originalIndex_old = hashValue % m_oldCap;
-        index = originalIndex_old;
-
-        // Scan the old table to find and update the DNA object's location
-        int j = 0;
-        while(j < m_oldCap){
-            if (m_oldTable[index] != nullptr && m_oldTable[index]->m_used){
-                if ( *m_oldTable[index] == dna ){ // Check for equality of DNA objects
-                    m_oldTable[index]->m_location = location; // Update location ID
-                    return true; // Update successful
-                }
-            }
-            // Move to the next index based on old probing policy
-            switch(m_oldProbing){
-                case QUADRATIC: 
-                    index = (originalIndex_old + j*j) % m_oldCap;
-                    break;
-                case DOUBLEHASH:
-                    {
-                        unsigned int hash2 = 11 - (hashValue % 11);
-                        index = (originalIndex_old + j * hash2) % m_oldCap;
-                        break;
-                    }
-                case LINEAR:
-                    index = (originalIndex_old + j) % m_oldCap;
-                    break;
+    bool flush(){
+        writeAll(m_buffer.data(), m_used);
+        m_used = 0;
+        return !m_failed;
+    }
+    private:
+    int          m_fd;
+    vector<char> m_buffer;
+    size_t       m_used;
+    bool         m_failed;
+    void writeAll(const char* data, size_t length){
+        while (length > 0 && !m_failed){
+            ssize_t n = ::write(m_fd, data, length);
+            if (n < 0){
+                m_failed = true;
+                return;
             }
-            j++;
+            data += n;
+            length -= n;
         }
     }
-    // DNA object not found in either table
-    return false;
+};
+
+// Header of a binary export: magic, format version, number of records.
+// Every record is a uint32 sequence length, an int32 location ID and the sequence.
+static const char EXPORTMAGIC[6] = {'D', 'N', 'A', 'D', 'B', '\0'};
+static const unsigned short EXPORTVERSION = 1;
+struct ExportHeader{
+    char           magic[6];
+    unsigned short version;
+    long long      count;
+};
+
+// Writes the used entries of slots [first, last) of a table or a snapshot to path,
+// returns their number or -1
+template <class Source>
+static long exportRange(const Source& source, const string& path, long first, long last, bool binary){
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    BufferedWriter writer(fd);
+    ExportHeader header;
+    memcpy(header.magic, EXPORTMAGIC, sizeof(header.magic));
+    header.version = EXPORTVERSION;
+    header.count = 0;
+    if (binary)
+        writer.put(&header, sizeof(header));
+
+    long count = 0;
+    char number[16];
+    for (long slot = first; slot < last; slot++){
+        const DnaDb::Slot* entry = source.usedSlot(slot);
+        if (entry == nullptr)
+            continue;
+        if (binary){
+            unsigned int length = (unsigned int)entry->key.size();
+            int location = entry->value;
+            writer.put(&length, sizeof(length));
+            writer.put(&location, sizeof(location));
+            writer.put(entry->key.data(), length);
+        }
+        else{
+            writer.put(entry->key.data(), entry->key.size());
+            // format the location ID by hand, snprintf dominates the export time
+            char* end = number + sizeof(number);
+            char* digit = end;
+            *--digit = '\n';
+            unsigned int location = entry->value < 0 ? -(unsigned int)entry->value : entry->value;
+            do {
+                *--digit = (char)('0' + location % 10);
+                location /= 10;
+            } while (location > 0);
+            if (entry->value < 0) *--digit = '-';
+            *--digit = '\t';
+            writer.put(digit, end - digit);
+        }
+        count++;
+    }
+    bool ok = writer.flush();
+    // the record count is only known at the end
+    if (ok && binary){
+        header.count = count;
+        ok = (pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header));
+    }
+    ok = (::close(fd) == 0) && ok;
+    return ok ? count : -1;
 }
 
-// Calculates the load factor of the current hash table
-float DnaDb::lambda() const {
-    return (float)m_currentSize / (float)m_currentCap;
+// Splits the slots in partitions written by one thread each to path.0, path.1, ...
+template <class Source>
+static long exportPartitioned(const Source& source, const string& path, int partitions, bool binary){
+    long total = source.slotCount();
+    if (partitions <= 1)
+        return exportRange(source, path, 0, total, binary);
+
+    vector<long> counts(partitions, 0);
+    vector<thread> workers;
+    for (int i = 0; i < partitions; i++){
+        workers.push_back(thread([&source, &counts, &path, i, partitions, total, binary]{
+            counts[i] = exportRange(source, path + "." + to_string(i), total * i / partitions,
+                                    total * (i + 1) / partitions, binary);
+        }));
+    }
+    long count = 0;
+    for (int i = 0; i < partitions; i++){
+        workers[i].join();
+        if (counts[i] < 0)
+            count = -1;
+        else if (count >= 0)
+            count += counts[i];
+    }
+    return count;
 }
 
-// Calculates the ratio of deleted items to active items in the current hash table
-float DnaDb::deletedRatio() const {
-    return (float)m_currNumDeleted / (float)m_currentSize;
+long DnaDb::exportTsv(const string& path, int partitions) const {
+    // Nothing may move while the threads read the tables
+    Cursor pin(*this);
+    return exportPartitioned(*this, path, partitions, false);
 }
 
-// Prints the contents of both the current and old hash tables
-void DnaDb::dump() const {
-    cout << "Dump for the current table: " << endl;
-    if (m_currentTable != nullptr)
-        for (int i = 0; i < m_currentCap; i++) {
-            cout << "[" << i << "] : " << m_currentTable[i] << endl;
-        }
-    cout << "Dump for the old table: " << endl;
-    if (m_oldTable != nullptr)
-        for (int i = 0; i < m_oldCap; i++) {
-            cout << "[" << i << "] : " << m_oldTable[i] << endl;
-        }
+long DnaDb::exportBinary(const string& path, int partitions) const {
+    Cursor pin(*this);
+    return exportPartitioned(*this, path, partitions, true);
 }
 
-// Checks if a given number is prime
-bool DnaDb::isPrime(int number){
-    bool result = true;
-    for (int i = 2; i <= number / 2; ++i) {
-        if (number % i == 0) {
-            result = false;
-            break;
-        }
-    }
-    return result;
+DnaSnapshot DnaDb::snapshot(){
+    return DnaSnapshot(Table::snapshot(), m_keyMode);
 }
 
-// Finds the next prime number greater than or equal to current, within defined bounds
-int DnaDb::findNextPrime(int current){
-    // We always stay within the range [MINPRIME-MAXPRIME]
-    // The smallest prime starts at MINPRIME
-    if (current < MINPRIME) current = MINPRIME - 1; // Adjust to start searching from just before MINPRIME
-    for (int i = current; i < MAXPRIME; i++) { 
-        for (int j = 2; j * j <= i; j++) { // Optimized primality test
-            if (i % j == 0) 
-                break; // Not prime
-            else if (j + 1 > sqrt(i) && i != current) { 
-                return i;
-            }
-        }
-    }
-    // If a user tries to go over MAXPRIME, return MAXPRIME
-    return MAXPRIME;
+const DNA DnaSnapshot::getDNA(string sequence, int location) const{
+    string scratch;
+    const string& key = keyFor(m_keyMode, sequence, scratch);
+    const int* found = m_view.findHashed(key, m_view.getHash()(key),
+                                         [location](int stored){return stored == location;});
+    if (found != nullptr)
+        return DNA(key, *found, true);
+    return DNA();
 }
 
-// Initiates a rehash operation, creating a new, larger table
-void DnaDb::rehash(){
-    // Determine the new capacity (next prime after 4 times the number of active elements)
-    int newCap = findNextPrime(4 * (m_currentSize - m_currNumDeleted));
-    DNA** newTable = new DNA*[newCap]; // Allocate memory for the new table
-    // Initialize pointers in the new table to nullptr
-    for (int i = 0; i < newCap; ++i) {
-        newTable[i] = nullptr;
-    }
+// A snapshot never changes, so the exports need no pin
+long DnaSnapshot::exportTsv(const string& path, int partitions) const {
+    return exportPartitioned(m_view, path, partitions, false);
+}
 
-    // Move the current table to the 'old' table state for incremental rehashing
-    m_oldTable = m_currentTable;
-    m_oldCap = m_currentCap;
-    m_oldSize = m_currentSize;
-    m_oldNumDeleted = m_currNumDeleted;
-    m_oldProbing = m_currProbing;
-
-    // Set up the new table as the current table
-    m_currentTable = newTable;
-    m_currentCap = newCap;
-    m_currentSize = 0; // Reset current size as items will be transferred
-    m_currNumDeleted = 0; // Reset deleted count for the new table
-    m_currProbing = m_newPolicy; // Apply the new probing policy
-
-    m_transferIndex = 0; // Reset the transfer index for incremental rehash
+long DnaSnapshot::exportBinary(const string& path, int partitions) const {
+    return exportPartitioned(m_view, path, partitions, true);
 }
 
-// Performs incremental rehash, moving a portion of elements from the old to the new table
-void DnaDb::incrementalRehash() {
-    // Return if there's no old table to rehash from
-    if (m_oldTable == nullptr) {
-        return; 
+// Loads a file written by exportBinary, returns the number of inserted entries or -1
+long DnaDb::importBinary(const string& path){
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+        return -1;
+    setvbuf(file, nullptr, _IOFBF, EXPORTBUFSIZE);
+    // bytes of the file, a corrupt record length must not allocate more than that
+    long long remaining = -1;
+    if (fseek(file, 0, SEEK_END) == 0)
+        remaining = ftell(file);
+    rewind(file);
+    ExportHeader header;
+    if (remaining < (long long)sizeof(header) || fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, EXPORTMAGIC, sizeof(header.magic)) != 0 ||
+        header.version != EXPORTVERSION || header.count < 0){
+        fclose(file);
+        return -1;
     }
-
-    // Determine how many elements to transfer in this increment (25% of old capacity)
-    int transferCount = std::floor(m_oldCap * 0.25);
-    // Iterate through a segment of the old table
-    for (int i = 0; i < transferCount; ++i) {
-        int index = (m_transferIndex + i) % m_oldCap; // Calculate index in old table
-
-        // If the slot in the old table is used (not null and not deleted)
-        if (m_oldTable[index] != nullptr && m_oldTable[index]->m_used) {
-            // Rehash the element into the new table
-            unsigned int hashValue = m_hash(m_oldTable[index]->m_sequence);
-            int newIndex = hashValue % m_currentCap;
-            int j = 0;
-            // Probe for an empty slot in the new table using the current probing policy
-            while (m_currentTable[newIndex] != nullptr && m_currentTable[newIndex]->m_used) {
-                switch (m_currProbing) {
-                    case QUADRATIC:
-                        newIndex = (hashValue % m_currentCap + j * j) % m_currentCap;
-                        break;
-                    case DOUBLEHASH:
-                    {
-                        unsigned int hash2 = 11 - (hashValue % 11); 
-                        newIndex = (hashValue % m_currentCap + j * hash2) % m_currentCap;
-                        break;
-                    }
-                    case LINEAR:
-                        newIndex = (hashValue % m_currentCap + j) % m_currentCap;
-                        break;
-                }
-                j++;
-            }
-            // Transfer the pointer from the old table to the new table
-            m_currentTable[newIndex] = m_oldTable[index];
-            m_currentTable[newIndex]->m_used = true; // Ensure it's marked as used
-            m_currentSize++; // Increment current table's size
-            m_oldSize--; // Decrement old table's size
+    remaining -= sizeof(header);
+    long inserted = 0;
+    vector<DNA> batch(IMPORTBATCH);
+    size_t used = 0;
+    bool ok = true;
+    for (long long i = 0; i < header.count && ok; i++){
+        unsigned int length;
+        int location;
+        ok = fread(&length, sizeof(length), 1, file) == 1 && fread(&location, sizeof(location), 1, file) == 1;
+        remaining -= sizeof(length) + sizeof(location) + (long long)length;
+        ok = ok && remaining >= 0;
+        // reuse the string buffers of the batch
+        if (ok){
+            string& sequence = batch[used].m_sequence;
+            sequence.resize(length);
+            ok = (length == 0) || fread(&sequence[0], 1, length, file) == length;
+            batch[used].m_location = location;
+        }
+        if (ok)
+            used++;
+        if (used == batch.size() || !ok || i + 1 == header.count){
+            batch.resize(used);
+            inserted += insertBatch(batch);
+            batch.resize(IMPORTBATCH);
+            used = 0;
         }
-        // Set the old table's slot to nullptr as the element has been moved or was empty/deleted
-        m_oldTable[index] = nullptr; // Ensure memory is managed (moved, not deleted here)
-    }
-
-    // Update the starting index for the next incremental transfer
-    m_transferIndex = (m_transferIndex + transferCount) % m_oldCap;
-
-    // If all elements from the old table have been transferred, deallocate the old table
-    if (m_oldSize == 0) {
-        delete[] m_oldTable;
-        m_oldTable = nullptr;
-        m_oldCap = 0;
     }
-}
\ No newline at end of file
+    fclose(file);
+    // a damaged record ends the import, the ones read before it stay in the table
+    return inserted;
+}
@@ -2,19 +2,24 @@
 #define DNADB_H
 #include <iostream>
 #include <string>
+#include <vector>
 #include "math.h"
+#include "hashdb.h"
 using namespace std;
 class Grader;   
 class Tester;   
 class DNA;      
 class DnaDb;    
-const int MINPRIME = 101;   // Min size for hash table
-const int MAXPRIME = 99991; // Max size for hash table
+class DnaCursor;
+class DnaSnapshot;
 const int MINLOCID = 100000;// Min Location ID
 const int MAXLOCID = 999999;// Max Location ID
+const size_t EXPORTBUFSIZE = 1 << 20; // bytes collected before each write() of an export
+const int IMPORTBATCH = 4096;  // records inserted together by importBinary
 typedef unsigned int (*hash_fn)(string);     // declaration of hash function
-enum prob_t {QUADRATIC, DOUBLEHASH, LINEAR}; // types of collision handling policy
-#define DEFPOLCY QUADRATIC
+// EXACT keys on the sequence as given, CANONICAL on the smaller of the sequence
+// and its reverse complement, so both strands are the same entry
+enum key_mode_t {EXACT, CANONICAL};
 const int MAX = 4;
 const char ALPHA[MAX] = {'A', 'C', 'G', 'T'};
 class DNA{
@@ -22,6 +27,8 @@ class DNA{
     friend class Grader;
     friend class Tester;
     friend class DnaDb;
+    friend class DnaCursor;
+    friend class DnaIngest;
     DNA(string sequence="", int location=0, bool used=false){
         m_sequence=sequence; m_location=location; m_used=used;
     }
@@ -29,6 +36,8 @@ class DNA{
     int getLocId() const {return m_location;}
     bool getUsed() const {return m_used;}
     void setSequence(string seq) {m_sequence=seq;}
+    // reuses the existing string buffer, used by bulk loaders
+    void setSequence(const char* seq, size_t length) {m_sequence.assign(seq, length);}
     void setLocID(int id) {m_location=id;}
     void setUsed(bool used) {m_used=used;}
 
@@ -66,54 +75,126 @@ class DNA{
     int m_location;     // location ID that the DNA is found
     bool m_used;
 };
-class DnaDb{
+// True if seq is not greater than its reverse complement (A, C, G, T compared with a
+// 2-bit kernel, 32 bases at a time; other characters fall back to a string compare)
+bool isCanonical(const char* seq, size_t length);
+// Reverse complement of seq in out; characters other than ACGT/acgt are kept as they are
+void reverseComplement(const char* seq, size_t length, string& out);
+// Packs length (1-32) bases into 2-bit codes (A=0, C=1, G=2, T=3), the first base
+// in the highest bits, so packed words compare like the sequences; false if a
+// letter is not an upper case A, C, G or T
+bool packSequence(const char* seq, int length, unsigned long long& word);
+// Reverse complement of length (1-32) packed bases
+unsigned long long reverseComplementPacked(unsigned long long word, int length);
+
+// Adapts a hash_fn to the functor interface of HashDb
+struct HashFnRef{
+    hash_fn m_fn;
+    HashFnRef(hash_fn fn = nullptr) : m_fn(fn){}
+    unsigned int operator()(const string& key) const {return m_fn(key);}
+};
+
+// Changes reported to a ChangeSink
+enum change_t : unsigned char {CHANGE_INSERT, CHANGE_REMOVE, CHANGE_UPDATE};
+
+// Receives every successful change of a DnaDb in order, see DnaDb::setChangeSink.
+// ChangeLog (dnadb_repl.h) implements it to replicate a table.
+class ChangeSink{
+    public:
+    virtual ~ChangeSink(){}
+    // key is the stored (canonical) sequence; previous is the location ID before a
+    // CHANGE_UPDATE, location the one after it
+    virtual void onChange(change_t type, const string& key, int location, int previous) = 0;
+};
+
+// The DNA table: sequences are the keys, location IDs the values. A sequence may
+// be stored at several locations, an entry is identified by both.
+class DnaDb : public HashDb<string, int, HashFnRef>{
     public:
+    typedef HashDb<string, int, HashFnRef> Table;
     friend class Grader;
     friend class Tester;
-    DnaDb(int size, hash_fn hash, prob_t probing);
-    ~DnaDb();
-    // Returns Load factor of the new table
-    float lambda() const;
-    // Returns the ratio of deleted buckets in the new table
-    float deletedRatio() const;
+    friend class DnaCursor;
+    DnaDb(int size, hash_fn hash, prob_t probing, key_mode_t mode = EXACT);
     // insert only happens in the new table
     bool insert(DNA dna);
+    // inserts every object of the batch, returns the number of inserted objects
+    int insertBatch(const vector<DNA>& batch);
+    // same as above, hashes[i] must be the value of this table's hash function for batch[i],
+    // in CANONICAL mode the sequences must have gone through canonicalize()
+    int insertBatch(const vector<DNA>& batch, const vector<unsigned int>& hashes);
+    // In CANONICAL mode replaces the sequence by its reverse complement if that is smaller
+    void canonicalize(DNA& dna) const;
     // remove can happen from either table
     bool remove(DNA dna);
-    // find can happen in either table
+    // find can happen in either table; in CANONICAL mode the returned object carries
+    // the stored (canonical) sequence
     const DNA getDNA(string sequence, int location) const;
     // update the information
     bool updateLocId(DNA dna, int location);
-    void changeProbPolicy(prob_t policy);
-    void dump() const;
+    hash_fn getHashFn() const {return getHash().m_fn;}
+    key_mode_t getKeyMode() const {return m_keyMode;}
+    // Write every used entry to path, as "sequence<TAB>location" lines or in the binary
+    // format read by importBinary. With partitions > 1 the tables are split in slot ranges
+    // written in parallel to path.0, path.1, ... Return the number of entries or -1.
+    long exportTsv(const string& path, int partitions = 1) const;
+    long exportBinary(const string& path, int partitions = 1) const;
+    // Inserts the entries of a binary export and returns the number inserted, -1 if the
+    // file cannot be opened or is not an export. A truncated or damaged record ends the
+    // import: the records before it stay inserted and are counted, so a count below the
+    // one exportBinary returned reveals a damaged file.
+    long importBinary(const string& path);
+    // Returns a consistent read-only view that other threads can query and export
+    // while this table keeps changing, see HashDb::snapshot()
+    DnaSnapshot snapshot();
+    // Reports every following insert, remove and updateLocId to sink (nullptr stops it),
+    // on the thread that makes the change
+    void setChangeSink(ChangeSink* sink) {m_changeSink = sink;}
+    ChangeSink* getChangeSink() const {return m_changeSink;}
     private:
-    hash_fn    m_hash;          // hash function
-    prob_t     m_newPolicy;     // stores the change of policy request
-
-    DNA**       m_currentTable; // hash table
-    int        m_currentCap;    // hash table size (capacity)
-    int        m_currentSize;   // current number of entries
-                                // m_currentSize includes deleted entries 
-    int        m_currNumDeleted;// number of deleted entries
-    prob_t     m_currProbing;   // collision handling policy
-
-    DNA**      m_oldTable;      // hash table
-    int        m_oldCap;        // hash table size (capacity)
-    int        m_oldSize;       // current number of entries
-                                // m_oldSize includes deleted entries
-    int        m_oldNumDeleted; // number of deleted entries
-    prob_t     m_oldProbing;    // collision handling policy
-
-    int        m_transferIndex; // used for incremental rehash
-                                
+    key_mode_t m_keyMode;       // EXACT or CANONICAL sequences as keys
+    ChangeSink* m_changeSink;   // receives the changes, usually nullptr
 
     //private helper functions
-    bool isPrime(int number);
-    int findNextPrime(int current);
-    //function to transfer elements from old to new table when the load factor is >0.5
-    void rehash();
-    //function to keep transfering nodes from the old table to the new table
-    void incrementalRehash();
+    const string& keyOf(const string& sequence, string& scratch) const;
+    bool insertHashed(const string& key, int location, unsigned int hashValue);
+};
+
+// Walks the used entries of a DnaDb, see HashDb::Cursor
+//
+//     DnaCursor cursor(db);
+//     while (cursor.next()) use(cursor.get());
+class DnaCursor{
+    public:
+    DnaCursor(const DnaDb& db) : m_cursor(db){}
+    DnaCursor(const DnaCursor&) = delete;
+    DnaCursor& operator=(const DnaCursor&) = delete;
+    // Moves to the next used entry, returns false at the end
+    bool next();
+    // The current entry, only valid after next() returned true
+    const DNA& get() const {return m_current;}
+    // False once a resize has invalidated the cursor
+    bool valid() const {return m_cursor.valid();}
+    private:
+    DnaDb::Table::Cursor m_cursor;
+    DNA                  m_current;  // copy of the current entry
+};
 
+// Point-in-time view of a DnaDb returned by DnaDb::snapshot(). Lookups and exports
+// see the entries as they were when it was taken, no matter what the table does
+// meanwhile; segments that only the snapshot still references are freed with it.
+class DnaSnapshot{
+    public:
+    // Same as DnaDb::getDNA
+    const DNA getDNA(string sequence, int location) const;
+    long size() const {return m_view.size();}
+    // Same as DnaDb::exportTsv/exportBinary, with no need to pause the table
+    long exportTsv(const string& path, int partitions = 1) const;
+    long exportBinary(const string& path, int partitions = 1) const;
+    private:
+    friend class DnaDb;
+    DnaSnapshot(const DnaDb::Table::Snapshot& view, key_mode_t mode) : m_view(view), m_keyMode(mode){}
+    DnaDb::Table::Snapshot m_view;
+    key_mode_t             m_keyMode;
 };
-#endif
\ No newline at end of file
+#endif
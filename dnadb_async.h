@@ -0,0 +1,170 @@
+#ifndef DNADB_ASYNC_H
+#define DNADB_ASYNC_H
+#if __cplusplus < 202002L || !__has_include(<coroutine>)
+#error "dnadb_async.h needs C++20 coroutines, build with -std=c++20"
+#endif
+#include "dnadb.h"
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <utility>
+using namespace std;
+
+const int ASYNCINFLIGHT = 16;   // lookups findAll keeps in flight
+
+// Coroutine lookups that hide the memory latency of large tables by interleaving
+// (the AMAC idea): every probe step prefetches what it reads next, a bucket or the
+// stored key, and suspends; the scheduler resumes the other lookups meanwhile, so
+// by the time a lookup runs again its memory is usually in the cache.
+//
+//     LookupScheduler scheduler;
+//     AsyncDnaDb async(database, scheduler);
+//     for (...) query(async, ...).spawn(scheduler);  // AsyncTask query(...){ DNA dna = co_await async.findAsync(seq, loc); ... }
+//     scheduler.run();
+//
+// Everything runs on the thread calling run(), and the table must not change
+// until run() returns. findAll does the above for a batch of queries.
+
+// Round-robin queue of suspended coroutines
+class LookupScheduler{
+    public:
+    struct Yield{
+        LookupScheduler& m_scheduler;
+        bool await_ready() const noexcept {return false;}
+        void await_suspend(coroutine_handle<> handle){m_scheduler.m_ready.push_back(handle);}
+        void await_resume() const noexcept {}
+    };
+    LookupScheduler() = default;
+    LookupScheduler(const LookupScheduler&) = delete;
+    LookupScheduler& operator=(const LookupScheduler&) = delete;
+    ~LookupScheduler(){
+        // coroutines that never finished, e.g. when run() was not called
+        for (coroutine_handle<> handle : m_ready) handle.destroy();
+    }
+    // co_await scheduler.yield() lets the other coroutines run first
+    Yield yield(){return Yield{*this};}
+    void schedule(coroutine_handle<> handle){m_ready.push_back(handle);}
+    // Resumes the queued coroutines until all of them are finished
+    void run(){
+        while (!m_ready.empty()){
+            coroutine_handle<> handle = m_ready.front();
+            m_ready.pop_front();
+            handle.resume();
+        }
+    }
+    private:
+    deque<coroutine_handle<>> m_ready;
+};
+
+// A top-level coroutine handed to a scheduler by AsyncTask::spawn; it starts at the first
+// run() and frees itself when it returns
+class AsyncTask{
+    public:
+    struct promise_type{
+        AsyncTask get_return_object(){return AsyncTask(coroutine_handle<promise_type>::from_promise(*this));}
+        suspend_always initial_suspend() noexcept {return {};}
+        suspend_never final_suspend() noexcept {return {};}
+        void return_void(){}
+        void unhandled_exception(){terminate();}
+    };
+    AsyncTask(AsyncTask&& other) noexcept : m_handle(exchange(other.m_handle, nullptr)){}
+    ~AsyncTask(){if (m_handle) m_handle.destroy();}
+    // Hands the coroutine to the scheduler
+    void spawn(LookupScheduler& scheduler){scheduler.schedule(exchange(m_handle, nullptr));}
+    private:
+    explicit AsyncTask(coroutine_handle<promise_type> handle) : m_handle(handle){}
+    coroutine_handle<promise_type> m_handle;
+};
+
+// The lookup returned by findAsync, its result is the value of co_await. It starts
+// when awaited and resumes the awaiting coroutine when it is done.
+class AsyncFind{
+    public:
+    struct promise_type{
+        DNA                result;
+        coroutine_handle<> waiting;
+        AsyncFind get_return_object(){return AsyncFind(coroutine_handle<promise_type>::from_promise(*this));}
+        suspend_always initial_suspend() noexcept {return {};}
+        struct Resume{
+            bool await_ready() const noexcept {return false;}
+            coroutine_handle<> await_suspend(coroutine_handle<promise_type> handle) noexcept {
+                return handle.promise().waiting;
+            }
+            void await_resume() const noexcept {}
+        };
+        Resume final_suspend() noexcept {return {};}
+        void return_value(DNA dna){result = std::move(dna);}
+        void unhandled_exception(){terminate();}
+    };
+    AsyncFind(AsyncFind&& other) noexcept : m_handle(exchange(other.m_handle, nullptr)){}
+    ~AsyncFind(){if (m_handle) m_handle.destroy();}
+    bool await_ready() const noexcept {return false;}
+    coroutine_handle<> await_suspend(coroutine_handle<> waiting) noexcept {
+        m_handle.promise().waiting = waiting;
+        return m_handle;
+    }
+    DNA await_resume(){return std::move(m_handle.promise().result);}
+    private:
+    explicit AsyncFind(coroutine_handle<promise_type> handle) : m_handle(handle){}
+    coroutine_handle<promise_type> m_handle;
+};
+
+// Asynchronous read interface of a DnaDb
+class AsyncDnaDb{
+    public:
+    AsyncDnaDb(const DnaDb& db, LookupScheduler& scheduler) : m_db(db), m_scheduler(scheduler){}
+    // co_await findAsync(sequence, location) gives what getDNA(sequence, location) returns
+    AsyncFind findAsync(string sequence, int location){
+        string scratch;
+        const string& key = keyOf(sequence, scratch);
+        auto sameLocation = [location](int stored){return stored == location;};
+        DnaDb::Table::Probe<decltype(sameLocation)> probe(m_db, key, m_db.getHash()(key), sameLocation);
+        do{
+            __builtin_prefetch(probe.address());
+            co_await m_scheduler.yield();
+        } while (probe.step());
+        if (probe.found() != nullptr)
+            co_return DNA(key, *probe.found(), true);
+        co_return DNA();
+    }
+    // Looks up every query with inflight lookups interleaved, results[i] answers queries[i]
+    void findAll(const vector<DNA>& queries, vector<DNA>& results, int inflight = ASYNCINFLIGHT){
+        results.assign(queries.size(), DNA());
+        size_t next = 0;
+        for (int i = 0; i < inflight && i < (int)queries.size(); i++)
+            worker(queries, results, next).spawn(m_scheduler);
+        m_scheduler.run();
+    }
+    private:
+    const DnaDb&     m_db;
+    LookupScheduler& m_scheduler;
+    // The sequence itself, or the canonical strand written to scratch
+    const string& keyOf(const string& sequence, string& scratch) const{
+        if (m_db.getKeyMode() == EXACT)
+            return sequence;
+        DNA query(sequence, 0);
+        m_db.canonicalize(query);
+        scratch = query.getSequence();
+        return scratch;
+    }
+    // Takes the next query until none is left. The probe loop of findAsync is
+    // repeated here so a lookup costs no coroutine frame of its own.
+    AsyncTask worker(const vector<DNA>& queries, vector<DNA>& results, size_t& next){
+        string sequence, scratch;
+        while (next < queries.size()){
+            size_t i = next++;
+            int location = queries[i].getLocId();
+            sequence = queries[i].getSequence();
+            const string& key = keyOf(sequence, scratch);
+            auto sameLocation = [location](int stored){return stored == location;};
+            DnaDb::Table::Probe<decltype(sameLocation)> probe(m_db, key, m_db.getHash()(key), sameLocation);
+            do{
+                __builtin_prefetch(probe.address());
+                co_await m_scheduler.yield();
+            } while (probe.step());
+            if (probe.found() != nullptr)
+                results[i] = DNA(key, *probe.found(), true);
+        }
+    }
+};
+#endif
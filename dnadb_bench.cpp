@@ -0,0 +1,475 @@
+#include "dnadb.h"
+#include "dnadb_frozen.h"
+#include "dnadb_kmer.h"
+#if __cplusplus >= 202002L
+#include "dnadb_async.h"
+#endif
+#include <benchmark/benchmark.h>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+#include <unistd.h>
+using namespace std;
+
+// Benchmarks for the DnaDb operations, for every collision policy, table sizes
+// from 10^3 up to DNADB_BENCH_MAX (default 10^7) and uniform/Zipfian key choice.
+// Besides items/s every operation benchmark reports ns/op, probes/op (buckets
+// visited per operation) and rss_MB (resident memory of the process).
+// The resize benchmarks time one full resize for 1 to 8 rehash threads, the placed
+// ones repeat find_hit with the buckets on huge pages and/or interleaved over the
+// NUMA nodes, from 1 to 8 threads (pin them to both sockets with numactl or taskset).
+// Built with -std=c++20, find_hit_async repeats find_hit with interleaved coroutine
+// lookups (AsyncDnaDb::findAll) for 1 to 64 lookups in flight. find_hit_frozen
+// repeats it on a FrozenDnaDb and reports its bytes/key, find_hit_kmer on a
+// KmerDb<16> holding the keys as packed words.
+//
+// g++ -std=c++20 -O2 dnadb.cpp dnadb_frozen.cpp dnadb_bench.cpp -o dnadb_bench -lbenchmark -pthread
+
+enum DIST {UNIFORM, ZIPF};
+const char* POLICYNAME[] = {"QUADRATIC", "DOUBLEHASH", "LINEAR"};
+const char* DISTNAME[] = {"uniform", "zipf"};
+const int BATCH = 1000;         // operations between two timer pauses
+const double ZIPFTHETA = 0.99;  // skew of the Zipfian distribution
+
+// Same hash function as the driver and the tests
+unsigned int hashCode(const string str) {
+    unsigned int val = 0 ;
+    const unsigned int thirtyThree = 33 ;
+    for ( size_t i = 0 ; i < str.length(); i++)
+        val = val * thirtyThree + str[i] ;
+    return val ;
+}
+
+// The i-th key: 16 bases derived from a mixed i, unique for every i < 2^32
+string keySequence(unsigned long long i){
+    unsigned long long x = (i * 0x9E3779B97F4A7C15ULL) ^ 0x5bd1e995ULL;
+    string sequence(16, 'A');
+    for (int k = 0; k < 16; k++){
+        sequence[k] = ALPHA[x & 3];
+        x >>= 2;
+    }
+    return sequence;
+}
+int keyLocation(unsigned long long i){
+    return MINLOCID + (int)(i % (MAXLOCID - MINLOCID + 1));
+}
+
+// Zipfian ranks in [0, n) (Gray et al., "Quickly generating billion-record
+// synthetic databases"), ranks are scattered so hot keys are not neighbours
+class ZipfGenerator{
+    public:
+    ZipfGenerator(long n, unsigned seed) : m_n(n), m_generator(seed), m_uniform(0.0, 1.0){
+        double zetan = 0;
+        for (long i = 1; i <= n; i++)
+            zetan += 1.0 / pow((double)i, ZIPFTHETA);
+        double zeta2 = 1.0 + 1.0 / pow(2.0, ZIPFTHETA);
+        m_alpha = 1.0 / (1.0 - ZIPFTHETA);
+        m_zetan = zetan;
+        m_eta = (1.0 - pow(2.0 / n, 1.0 - ZIPFTHETA)) / (1.0 - zeta2 / zetan);
+    }
+    long next(){
+        double u = m_uniform(m_generator);
+        double uz = u * m_zetan;
+        long rank;
+        if (uz < 1.0) rank = 0;
+        else if (uz < 1.0 + pow(0.5, ZIPFTHETA)) rank = 1;
+        else rank = (long)(m_n * pow(m_eta * u - m_eta + 1.0, m_alpha));
+        if (rank >= m_n) rank = m_n - 1;
+        return (long)(((unsigned long long)rank * 0x9E3779B97F4A7C15ULL) % m_n);
+    }
+    private:
+    long   m_n;
+    double m_alpha, m_zetan, m_eta;
+    mt19937_64 m_generator;
+    uniform_real_distribution<double> m_uniform;
+};
+
+// Key indexes in [0, n) following the requested distribution
+vector<long> makeKeyStream(long n, DIST dist, long count, unsigned seed){
+    vector<long> keys(count);
+    if (dist == UNIFORM){
+        mt19937_64 generator(seed);
+        uniform_int_distribution<long> uniform(0, n - 1);
+        for (long i = 0; i < count; i++) keys[i] = uniform(generator);
+    }
+    else{
+        ZipfGenerator zipf(n, seed);
+        for (long i = 0; i < count; i++) keys[i] = zipf.next();
+    }
+    return keys;
+}
+
+// Resident set size in MB
+double residentMB(){
+    long pages = 0, resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm){
+        if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) resident = 0;
+        fclose(statm);
+    }
+    return resident * (double)sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+}
+
+// Building a table of 10^7 entries takes a while, so the last one built is
+// reused by all benchmarks registered for the same policy and size
+struct TableCache{
+    unique_ptr<DnaDb> db;
+    prob_t policy = DEFPOLCY;
+    long size = -1;
+};
+TableCache cache;
+
+DnaDb& filledTable(prob_t policy, long size){
+    if (cache.db == nullptr || cache.policy != policy || cache.size != size){
+        cache.db.reset();
+        cache.db.reset(new DnaDb(MINPRIME, hashCode, policy));
+        for (long i = 0; i < size; i++)
+            cache.db->insert(DNA(keySequence(i), keyLocation(i)));
+        cache.policy = policy;
+        cache.size = size;
+    }
+    return *cache.db;
+}
+
+// Throughput, time per operation and memory of a run of ops operations
+void reportRate(benchmark::State& state, long long ops){
+    state.counters["ns/op"] = benchmark::Counter((double)ops, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+    state.counters["rss_MB"] = residentMB();
+    state.SetItemsProcessed(ops);
+}
+// Same, plus the buckets visited by the ops operations
+void report(benchmark::State& state, long long probes, long long ops){
+    reportRate(state, ops);
+    state.counters["probes/op"] = ops ? (double)probes / ops : 0;
+}
+
+// size inserts into an empty table, including every rehash on the way. The keys
+// are drawn from the distribution, so a key drawn again is rejected as a duplicate;
+// under Zipf most inserts of the hot keys are such rejections, as when the same
+// reads are loaded twice
+void BM_Insert(benchmark::State& state, prob_t policy, long size, DIST dist){
+    vector<long> keys = makeKeyStream(size, dist, size, 6);
+    vector<DNA> entries;
+    for (size_t i = 0; i < keys.size(); i++)
+        entries.push_back(DNA(keySequence(keys[i]), keyLocation(keys[i])));
+    long long ops = 0, probes = 0;
+    double rss = 0;
+    for (auto _ : state){
+        unique_ptr<DnaDb> db(new DnaDb(MINPRIME, hashCode, policy));
+        for (size_t i = 0; i < entries.size(); i++)
+            benchmark::DoNotOptimize(db->insert(entries[i]));
+        ops += entries.size();
+        probes += db->probeCount();
+        state.PauseTiming(); // keep the destructor out of the measurement
+        rss = residentMB();
+        db.reset();
+        state.ResumeTiming();
+    }
+    report(state, probes, ops);
+    state.counters["rss_MB"] = rss;
+}
+
+// Lookups of stored entries
+void BM_FindHit(benchmark::State& state, prob_t policy, long size, DIST dist){
+    DnaDb& db = filledTable(policy, size);
+    vector<long> keys = makeKeyStream(size, dist, 1 << 16, 1);
+    vector<DNA> queries;
+    for (size_t i = 0; i < keys.size(); i++)
+        queries.push_back(DNA(keySequence(keys[i]), keyLocation(keys[i])));
+    long long probes = db.probeCount(), ops = 0;
+    size_t next = 0;
+    for (auto _ : state){
+        const DNA& query = queries[next];
+        benchmark::DoNotOptimize(db.getDNA(query.getSequence(), query.getLocId()));
+        next = (next + 1) % queries.size();
+        ops++;
+    }
+    report(state, db.probeCount() - probes, ops);
+}
+
+// Lookups of sequences that are not stored
+void BM_FindMiss(benchmark::State& state, prob_t policy, long size, DIST dist){
+    DnaDb& db = filledTable(policy, size);
+    vector<long> keys = makeKeyStream(size, dist, 1 << 16, 2);
+    vector<DNA> queries;
+    for (size_t i = 0; i < keys.size(); i++)
+        queries.push_back(DNA(keySequence(keys[i] + (1L << 32) - size), keyLocation(keys[i])));
+    long long probes = db.probeCount(), ops = 0;
+    size_t next = 0;
+    for (auto _ : state){
+        const DNA& query = queries[next];
+        benchmark::DoNotOptimize(db.getDNA(query.getSequence(), query.getLocId()));
+        next = (next + 1) % queries.size();
+        ops++;
+    }
+    report(state, db.probeCount() - probes, ops);
+}
+
+// Removing stored entries; they are inserted back with the timer paused. A key
+// drawn twice in one batch is already gone, so under Zipf many removes miss
+void BM_Remove(benchmark::State& state, prob_t policy, long size, DIST dist){
+    DnaDb& db = filledTable(policy, size);
+    vector<long> keys = makeKeyStream(size, dist, 1 << 16, 7);
+    vector<DNA> queries;
+    for (size_t i = 0; i < keys.size(); i++)
+        queries.push_back(DNA(keySequence(keys[i]), keyLocation(keys[i])));
+    long long probes = 0, ops = 0;
+    size_t next = 0;
+    vector<DNA> removed;
+    for (auto _ : state){
+        const DNA& dna = queries[next];
+        long long before = db.probeCount();
+        bool found = db.remove(dna);
+        benchmark::DoNotOptimize(found);
+        probes += db.probeCount() - before;
+        if (found)
+            removed.push_back(dna);
+        next = (next + 1) % queries.size();
+        ops++;
+        if (removed.size() == BATCH){
+            state.PauseTiming();
+            for (size_t i = 0; i < removed.size(); i++) db.insert(removed[i]);
+            removed.clear();
+            state.ResumeTiming();
+        }
+    }
+    for (size_t i = 0; i < removed.size(); i++) db.insert(removed[i]);
+    report(state, probes, ops);
+}
+
+// Moving stored entries to another location ID and back
+void BM_UpdateLocId(benchmark::State& state, prob_t policy, long size, DIST dist){
+    DnaDb& db = filledTable(policy, size);
+    vector<long> keys = makeKeyStream(size, dist, 1 << 16, 3);
+    vector<DNA> queries;
+    for (size_t i = 0; i < keys.size(); i++)
+        queries.push_back(DNA(keySequence(keys[i]), keyLocation(keys[i])));
+    long long probes = db.probeCount(), ops = 0;
+    size_t next = 0;
+    for (auto _ : state){
+        DNA& query = queries[next];
+        // alternate between the original location ID and a shifted one
+        int location = (query.getLocId() == MAXLOCID) ? MINLOCID : query.getLocId() + 1;
+        benchmark::DoNotOptimize(db.updateLocId(query, location));
+        query.setLocID(location);
+        next = (next + 1) % queries.size();
+        ops++;
+    }
+    // put every key back to its original location ID for the other benchmarks
+    for (size_t i = 0; i < queries.size(); i++)
+        db.updateLocId(queries[i], keyLocation(keys[i]));
+    report(state, db.probeCount() - probes, ops);
+}
+
+// Lookups while a rehash is in progress and entries live in both tables
+void BM_FindDuringRehash(benchmark::State& state, prob_t policy, long size, DIST dist){
+    DnaDb db(MINPRIME, hashCode, policy);
+    long count = 0;
+    // fill to size, then keep inserting until an insert starts a rehash
+    while (count < size || !db.rehashing()){
+        db.insert(DNA(keySequence(count), keyLocation(count)));
+        count++;
+    }
+    vector<long> keys = makeKeyStream(count, dist, 1 << 16, 4);
+    vector<DNA> queries;
+    for (size_t i = 0; i < keys.size(); i++)
+        queries.push_back(DNA(keySequence(keys[i]), keyLocation(keys[i])));
+    long long probes = db.probeCount(), ops = 0;
+    size_t next = 0;
+    for (auto _ : state){
+        const DNA& query = queries[next];
+        benchmark::DoNotOptimize(db.getDNA(query.getSequence(), query.getLocId()));
+        next = (next + 1) % queries.size();
+        ops++;
+    }
+    report(state, db.probeCount() - probes, ops);
+}
+
+// One resize of a table holding about size entries, every entry moved at once by the
+// given number of threads (see setRehashThreads); the inserts before it are not timed
+void BM_Resize(benchmark::State& state, prob_t policy, long size, int threads){
+    long long entries = 0;
+    for (auto _ : state){
+        state.PauseTiming();
+        unique_ptr<DnaDb> db(new DnaDb(MINPRIME, hashCode, policy));
+        db->setRehashThreads(threads);
+        long count = 0;
+        for (; count < size; count++)
+            db->insert(DNA(keySequence(count), keyLocation(count)));
+        // fill up to the load factor where the next insert resizes the table
+        DnaDbStats gauges = db->stats();
+        long used = gauges.size;
+        while ((float)(used + 1) / (float)gauges.capacity <= TablePolicy::MAXLOAD){
+            db->insert(DNA(keySequence(count), keyLocation(count)));
+            count++;
+            used++;
+        }
+        entries += db->size();
+        state.ResumeTiming();
+        db->insert(DNA(keySequence(count), keyLocation(count)));
+        state.PauseTiming();
+        state.counters["rss_MB"] = residentMB();
+        db.reset();
+        state.ResumeTiming();
+    }
+    state.counters["ns/entry"] = benchmark::Counter((double)entries, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+    state.SetItemsProcessed(entries);
+}
+
+#if __cplusplus >= 202002L
+// Lookups of stored entries, a batch at a time with inflight coroutine lookups interleaved
+void BM_FindHitAsync(benchmark::State& state, long size, int inflight){
+    DnaDb& db = filledTable(DEFPOLCY, size);
+    vector<long> keys = makeKeyStream(size, UNIFORM, 1 << 16, 1);
+    vector<DNA> queries, results;
+    for (size_t i = 0; i < keys.size(); i++)
+        queries.push_back(DNA(keySequence(keys[i]), keyLocation(keys[i])));
+    LookupScheduler scheduler;
+    AsyncDnaDb async(db, scheduler);
+    long long probes = db.probeCount(), ops = 0;
+    for (auto _ : state){
+        async.findAll(queries, results, inflight);
+        benchmark::DoNotOptimize(results.data());
+        ops += queries.size();
+    }
+    report(state, db.probeCount() - probes, ops);
+}
+#endif
+
+// Lookups of stored entries in the frozen encoding of a table
+void BM_FindHitFrozen(benchmark::State& state, long size){
+    FrozenDnaDb frozen(filledTable(DEFPOLCY, size));
+    vector<long> keys = makeKeyStream(size, UNIFORM, 1 << 16, 1);
+    vector<DNA> queries;
+    for (size_t i = 0; i < keys.size(); i++)
+        queries.push_back(DNA(keySequence(keys[i]), keyLocation(keys[i])));
+    long long ops = 0;
+    size_t next = 0;
+    for (auto _ : state){
+        const DNA& query = queries[next];
+        benchmark::DoNotOptimize(frozen.getDNA(query.getSequence(), query.getLocId()));
+        next = (next + 1) % queries.size();
+        ops++;
+    }
+    reportRate(state, ops);
+    state.counters["bytes/key"] = (double)frozen.bytes() / max(1L, frozen.keys());
+}
+
+// Lookups of stored entries in a table of packed 16-mers
+void BM_FindHitKmer(benchmark::State& state, long size){
+    KmerDb<16> db(MINPRIME, hashCode, DEFPOLCY);
+    for (long i = 0; i < size; i++)
+        db.insert(DNA(keySequence(i), keyLocation(i)));
+    vector<long> keys = makeKeyStream(size, UNIFORM, 1 << 16, 1);
+    vector<DNA> queries;
+    for (size_t i = 0; i < keys.size(); i++)
+        queries.push_back(DNA(keySequence(keys[i]), keyLocation(keys[i])));
+    long long ops = 0;
+    size_t next = 0;
+    for (auto _ : state){
+        const DNA& query = queries[next];
+        benchmark::DoNotOptimize(db.getDNA(query.getSequence(), query.getLocId()));
+        next = (next + 1) % queries.size();
+        ops++;
+    }
+    reportRate(state, ops);
+}
+
+// Lookups of stored entries in a table placed with setPlacement, read by several
+// threads through a snapshot (the table itself takes a single thread)
+const char* PLACEMENTNAME[] = {"default", "hugepages", "interleave", "hugepages+interleave"};
+unique_ptr<DnaDb> placedTable;
+unique_ptr<DnaSnapshot> placedView;
+void BM_FindHitPlaced(benchmark::State& state, placement_t placement, long size){
+    if (state.thread_index() == 0){
+        placedTable.reset(new DnaDb(MINPRIME, hashCode, DEFPOLCY));
+        placedTable->setPlacement(placement);
+        for (long i = 0; i < size; i++)
+            placedTable->insert(DNA(keySequence(i), keyLocation(i)));
+        placedView.reset(new DnaSnapshot(placedTable->snapshot()));
+    }
+    vector<long> keys = makeKeyStream(size, UNIFORM, 1 << 16, 5 + state.thread_index());
+    vector<DNA> queries;
+    for (size_t i = 0; i < keys.size(); i++)
+        queries.push_back(DNA(keySequence(keys[i]), keyLocation(keys[i])));
+    long long ops = 0;
+    size_t next = 0;
+    for (auto _ : state){
+        const DNA& query = queries[next];
+        benchmark::DoNotOptimize(placedView->getDNA(query.getSequence(), query.getLocId()));
+        next = (next + 1) % queries.size();
+        ops++;
+    }
+    state.SetItemsProcessed(ops);
+    if (state.thread_index() == 0)
+        state.counters["rss_MB"] = residentMB();
+}
+
+typedef void (*bench_fn)(benchmark::State&, prob_t, long, DIST);
+
+int main(int argc, char** argv){
+    long maxSize = 10000000;
+    if (getenv("DNADB_BENCH_MAX"))
+        maxSize = atol(getenv("DNADB_BENCH_MAX"));
+
+    struct {const char* name; bench_fn fn; bool skewed;} benches[] = {
+        {"insert", BM_Insert, true},
+        {"find_hit", BM_FindHit, true},
+        {"find_miss", BM_FindMiss, true},
+        {"remove", BM_Remove, true},
+        {"update_locid", BM_UpdateLocId, true},
+        {"find_during_rehash", BM_FindDuringRehash, true},
+    };
+    // Registered by policy and size first so the cached table is reused
+    prob_t policies[] = {QUADRATIC, DOUBLEHASH, LINEAR};
+    for (prob_t policy : policies){
+        for (long size = 1000; size <= maxSize; size *= 10){
+            for (auto& bench : benches){
+                for (int dist = UNIFORM; dist <= (bench.skewed ? ZIPF : UNIFORM); dist++){
+                    string name = string(bench.name) + "/" + POLICYNAME[policy] + "/" +
+                                  to_string(size) + "/" + DISTNAME[dist];
+                    benchmark::RegisterBenchmark(name.c_str(), bench.fn, policy, size, (DIST)dist);
+                }
+            }
+        }
+    }
+    for (prob_t policy : policies){
+        for (long size = 10000; size <= maxSize; size *= 10){
+            for (int threads = 1; threads <= 8; threads *= 2){
+                string name = string("resize/") + POLICYNAME[policy] + "/" + to_string(size) +
+                              "/threads:" + to_string(threads);
+                benchmark::RegisterBenchmark(name.c_str(), BM_Resize, policy, size, threads)->UseRealTime();
+            }
+        }
+    }
+#if __cplusplus >= 202002L
+    for (long size = 1000; size <= maxSize; size *= 10){
+        for (int inflight = 1; inflight <= 64; inflight *= 4){
+            string name = string("find_hit_async/") + POLICYNAME[DEFPOLCY] + "/" + to_string(size) +
+                          "/inflight:" + to_string(inflight);
+            benchmark::RegisterBenchmark(name.c_str(), BM_FindHitAsync, size, inflight);
+        }
+    }
+#endif
+    for (long size = 1000; size <= maxSize; size *= 10){
+        string name = string("find_hit_frozen/") + to_string(size);
+        benchmark::RegisterBenchmark(name.c_str(), BM_FindHitFrozen, size);
+    }
+    for (long size = 1000; size <= maxSize; size *= 10){
+        string name = string("find_hit_kmer/") + to_string(size);
+        benchmark::RegisterBenchmark(name.c_str(), BM_FindHitKmer, size);
+    }
+    placement_t placements[] = {PLACE_DEFAULT, PLACE_HUGEPAGES, PLACE_INTERLEAVE, PLACE_HUGEPAGES | PLACE_INTERLEAVE};
+    for (long size = 100000; size <= maxSize; size *= 10){
+        for (placement_t placement : placements){
+            string name = string("find_hit_placed/") + PLACEMENTNAME[placement] + "/" + to_string(size);
+            benchmark::RegisterBenchmark(name.c_str(), BM_FindHitPlaced, placement, size)->ThreadRange(1, 8)->UseRealTime();
+        }
+    }
+    benchmark::Initialize(&argc, argv);
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
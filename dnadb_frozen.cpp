@@ -0,0 +1,318 @@
+#include "dnadb_frozen.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <unordered_map>
+#include <unordered_set>
+
+const int WORDBASES = 32;   // bases packed in one 64-bit word
+
+// 2-bit code of each letter, -1 for the ones that cannot be packed
+struct BaseCodes{
+    signed char code[256];
+    BaseCodes(){
+        for (int i = 0; i < 256; i++) code[i] = -1;
+        code['A'] = 0; code['C'] = 1; code['G'] = 2; code['T'] = 3;
+    }
+};
+static const BaseCodes BASECODES;
+
+static uint64_t mix64(uint64_t x){
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Bits needed for values up to value
+static int bitsFor(uint64_t value){
+    int bits = 0;
+    for (; value > 0; value >>= 1) bits++;
+    return bits;
+}
+
+// Packs key in words, WORDBASES bases per word, and returns its fingerprint;
+// false if a letter cannot be packed
+static bool packKey(const string& key, uint64_t* words, uint64_t& fingerprint){
+    uint64_t hash = mix64(key.size() ^ 0x9e3779b97f4a7c15ULL);
+    for (size_t first = 0; first < key.size(); first += WORDBASES){
+        uint64_t word = 0;
+        size_t last = min(key.size(), first + WORDBASES);
+        for (size_t i = first; i < last; i++){
+            int code = BASECODES.code[(unsigned char)key[i]];
+            if (code < 0)
+                return false;
+            word |= (uint64_t)code << (2 * (i - first));
+        }
+        words[first / WORDBASES] = word;
+        hash = mix64(hash ^ word);
+    }
+    fingerprint = hash;
+    return true;
+}
+
+void PackedArray::set(long index, uint64_t value){
+    long position = index * m_width;
+    long word = position >> 6;
+    int shift = position & 63;
+    uint64_t mask = m_width == 64 ? ~0ULL : (1ULL << m_width) - 1;
+    value &= mask;
+    m_words[word] = (m_words[word] & ~(mask << shift)) | (value << shift);
+    if (shift + m_width > 64){
+        int spill = shift + m_width - 64;
+        m_words[word + 1] = (m_words[word + 1] & ~((1ULL << spill) - 1)) | (value >> (64 - shift));
+    }
+}
+
+// Takes the words over
+RankedBits::RankedBits(vector<uint64_t>& words){
+    m_words.swap(words);
+    m_words.shrink_to_fit();
+    m_blocks.reserve(m_words.size() / 8 + 1);
+    uint64_t count = 0;
+    for (size_t i = 0; i < m_words.size(); i++){
+        if (i % 8 == 0)
+            m_blocks.push_back(count);
+        count += __builtin_popcountll(m_words[i]);
+    }
+}
+
+long RankedBits::rank(long bit) const{
+    long word = bit >> 6;
+    long rank = m_blocks[word >> 3];
+    for (long i = word & ~7L; i < word; i++)
+        rank += __builtin_popcountll(m_words[i]);
+    if (bit & 63)
+        rank += __builtin_popcountll(m_words[word] << (64 - (bit & 63)));
+    return rank;
+}
+
+// Bit of a fingerprint in a level of size bits
+static long levelBit(uint64_t fingerprint, int level, long size){
+    uint64_t hash = mix64(fingerprint + (uint64_t)(level + 1) * 0x9e3779b97f4a7c15ULL);
+    return (long)(((unsigned __int128)hash * (uint64_t)size) >> 64);
+}
+
+void MinimalPerfectHash::build(const vector<uint64_t>& fingerprints, vector<uint64_t>& leftover){
+    vector<uint64_t> remaining(fingerprints), next, all;
+    m_levelStart.clear();
+    m_levelSize.clear();
+    m_placed = 0;
+    for (int level = 0; level < FROZENLEVELS && !remaining.empty(); level++){
+        long size = ((long)ceil(FROZENGAMMA * remaining.size()) + 63) / 64 * 64;
+        vector<uint64_t> seen(size / 64, 0), collided(size / 64, 0);
+        for (uint64_t fingerprint : remaining){
+            long bit = levelBit(fingerprint, level, size);
+            uint64_t mask = 1ULL << (bit & 63);
+            if (seen[bit >> 6] & mask)
+                collided[bit >> 6] |= mask;
+            seen[bit >> 6] |= mask;
+        }
+        // the colliding keys try again on the next level
+        next.clear();
+        for (uint64_t fingerprint : remaining){
+            long bit = levelBit(fingerprint, level, size);
+            if (collided[bit >> 6] & (1ULL << (bit & 63)))
+                next.push_back(fingerprint);
+        }
+        for (size_t i = 0; i < seen.size(); i++)
+            all.push_back(seen[i] & ~collided[i]);
+        m_levelStart.push_back(level == 0 ? 0 : m_levelStart.back() + m_levelSize.back());
+        m_levelSize.push_back(size);
+        m_placed += remaining.size() - next.size();
+        remaining.swap(next);
+    }
+    leftover = remaining;
+    m_bits = RankedBits(all);
+}
+
+long MinimalPerfectHash::lookup(uint64_t fingerprint) const{
+    for (size_t level = 0; level < m_levelStart.size(); level++){
+        long bit = m_levelStart[level] + levelBit(fingerprint, level, m_levelSize[level]);
+        if (m_bits.test(bit))
+            return m_bits.rank(bit);
+    }
+    return -1;
+}
+
+FrozenDnaDb::FrozenDnaDb(const DnaDb& db) : m_keyMode(db.getKeyMode()), m_entries(0), m_length(-1), m_locationBase(0){
+    // location IDs by sequence
+    unordered_map<string, vector<int>> grouped;
+    {
+        DnaCursor cursor(db);
+        while (cursor.next()){
+            grouped[cursor.get().getSequence()].push_back(cursor.get().getLocId());
+            m_entries++;
+        }
+    }
+    typedef unordered_map<string, vector<int>>::value_type Group;
+    vector<Group*> packed;
+    vector<uint64_t> fingerprints, words;
+    int lowest = INT_MAX, highest = INT_MIN;
+    bool single = true;
+    for (Group& group : grouped){
+        sort(group.second.begin(), group.second.end());
+        lowest = min(lowest, group.second.front());
+        highest = max(highest, group.second.back());
+        single = single && group.second.size() == 1;
+        uint64_t fingerprint;
+        words.resize(group.first.size() / WORDBASES + 1);
+        if (packKey(group.first, words.data(), fingerprint)){
+            packed.push_back(&group);
+            fingerprints.push_back(fingerprint);
+        }
+        else
+            m_exceptions.push_back(Exception{group.first, group.second});
+    }
+
+    // keys the perfect hash cannot place join the exceptions
+    vector<uint64_t> leftover;
+    m_hash.build(fingerprints, leftover);
+    unordered_set<uint64_t> unplaced(leftover.begin(), leftover.end());
+    vector<Group*> byIndex(m_hash.placed(), nullptr);
+    long totalBases = 0;
+    for (size_t i = 0; i < packed.size(); i++){
+        if (unplaced.count(fingerprints[i])){
+            m_exceptions.push_back(Exception{packed[i]->first, packed[i]->second});
+            continue;
+        }
+        byIndex[m_hash.lookup(fingerprints[i])] = packed[i];
+        totalBases += packed[i]->first.size();
+    }
+    sort(m_exceptions.begin(), m_exceptions.end(),
+         [](const Exception& lhs, const Exception& rhs){return lhs.sequence < rhs.sequence;});
+    long count = byIndex.size();
+
+    // sequences, with their start bases only if the lengths differ
+    m_length = count > 0 ? byIndex[0]->first.size() : 0;
+    for (long i = 0; i < count && m_length >= 0; i++)
+        if ((int)byIndex[i]->first.size() != m_length)
+            m_length = -1;
+    m_bases = PackedArray(totalBases, 2);
+    if (m_length < 0)
+        m_baseStart = PackedArray(count + 1, bitsFor(totalBases));
+    long base = 0;
+    for (long i = 0; i < count; i++){
+        if (m_length < 0)
+            m_baseStart.set(i, base);
+        for (char letter : byIndex[i]->first)
+            m_bases.set(base++, BASECODES.code[(unsigned char)letter]);
+    }
+    if (m_length < 0)
+        m_baseStart.set(count, base);
+
+    // the smallest location ID of each sequence relative to the smallest of all
+    m_locationBase = count > 0 ? lowest : 0;
+    m_locations = PackedArray(count, count > 0 ? bitsFor((uint64_t)((long long)highest - lowest)) : 0);
+    for (long i = 0; i < count; i++)
+        m_locations.set(i, (uint64_t)((long long)byIndex[i]->second[0] - m_locationBase));
+    if (single)
+        return;
+    // the others as deltas, found by the rank of the sequence among those that have more
+    vector<uint64_t> hasMore((count + 63) / 64, 0);
+    vector<long> starts;
+    for (long i = 0; i < count; i++){
+        const vector<int>& locations = byIndex[i]->second;
+        if (locations.size() < 2)
+            continue;
+        hasMore[i >> 6] |= 1ULL << (i & 63);
+        starts.push_back(m_deltas.size());
+        for (size_t j = 1; j < locations.size(); j++){
+            uint64_t delta = (uint64_t)((long long)locations[j] - locations[j - 1]);
+            for (; delta >= 0x80; delta >>= 7)
+                m_deltas.push_back((uint8_t)(delta | 0x80));
+            m_deltas.push_back((uint8_t)delta);
+        }
+    }
+    starts.push_back(m_deltas.size());
+    m_deltas.shrink_to_fit();
+    m_hasMore = RankedBits(hasMore);
+    m_moreStart = PackedArray(starts.size(), bitsFor(m_deltas.size()));
+    for (size_t i = 0; i < starts.size(); i++)
+        m_moreStart.set(i, starts[i]);
+}
+
+// Index of a packed key, -1 if the key is not among them
+long FrozenDnaDb::find(const string& key) const{
+    uint64_t local[8];
+    vector<uint64_t> large;
+    size_t needed = key.size() / WORDBASES + 1;
+    uint64_t* words = local;
+    if (needed > 8){
+        large.resize(needed);
+        words = large.data();
+    }
+    uint64_t fingerprint;
+    if (!packKey(key, words, fingerprint))
+        return -1;
+    long index = m_hash.lookup(fingerprint);
+    if (index < 0)
+        return -1;
+    // any key gets an index, only the stored one is equal
+    long first = m_length >= 0 ? index * m_length : (long)m_baseStart.get(index);
+    long length = m_length >= 0 ? m_length : (long)m_baseStart.get(index + 1) - first;
+    if (length != (long)key.size())
+        return -1;
+    for (long done = 0; done < length; done += WORDBASES){
+        int bases = min((long)WORDBASES, length - done);
+        if (m_bases.bits(2 * (first + done), 2 * bases) != words[done / WORDBASES])
+            return -1;
+    }
+    return index;
+}
+
+bool FrozenDnaDb::hasLocation(long index, int location) const{
+    if ((long long)location < m_locationBase)
+        return false;
+    uint64_t wanted = (uint64_t)((long long)location - m_locationBase);
+    uint64_t current = m_locations.get(index);
+    if (current >= wanted)
+        return current == wanted;
+    if (m_hasMore.size() == 0 || !m_hasMore.test(index))
+        return false;
+    // the locations are sorted, so the walk stops once it passes the wanted one
+    long more = m_hasMore.rank(index);
+    long end = m_moreStart.get(more + 1);
+    for (long at = m_moreStart.get(more); at < end;){
+        uint64_t delta = 0;
+        for (int shift = 0; ; shift += 7){
+            uint8_t byte = m_deltas[at++];
+            delta |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                break;
+        }
+        current += delta;
+        if (current >= wanted)
+            return current == wanted;
+    }
+    return false;
+}
+
+const DNA FrozenDnaDb::getDNA(string sequence, int location) const{
+    string scratch;
+    const string* key = &sequence;
+    if (m_keyMode == CANONICAL && !isCanonical(sequence.data(), sequence.size())){
+        reverseComplement(sequence.data(), sequence.size(), scratch);
+        key = &scratch;
+    }
+    long index = find(*key);
+    if (index >= 0)
+        return hasLocation(index, location) ? DNA(*key, location, true) : DNA();
+    if (m_exceptions.empty())
+        return DNA();
+    vector<Exception>::const_iterator it = lower_bound(m_exceptions.begin(), m_exceptions.end(), *key,
+        [](const Exception& exception, const string& wanted){return exception.sequence < wanted;});
+    if (it != m_exceptions.end() && it->sequence == *key &&
+        binary_search(it->locations.begin(), it->locations.end(), location))
+        return DNA(*key, location, true);
+    return DNA();
+}
+
+size_t FrozenDnaDb::bytes() const{
+    size_t total = sizeof(*this) + m_hash.bytes() + m_bases.bytes() + m_baseStart.bytes() +
+                   m_locations.bytes() + m_hasMore.bytes() + m_moreStart.bytes() + m_deltas.capacity();
+    for (const Exception& exception : m_exceptions)
+        total += sizeof(exception) + exception.sequence.capacity() + exception.locations.capacity() * sizeof(int);
+    return total;
+}
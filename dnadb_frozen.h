@@ -0,0 +1,124 @@
+#ifndef DNADB_FROZEN_H
+#define DNADB_FROZEN_H
+#include "dnadb.h"
+#include <cstdint>
+#include <vector>
+using namespace std;
+
+const double FROZENGAMMA = 2.0;  // bits per remaining key in each level of the perfect hash
+const int FROZENLEVELS = 32;     // levels before the keys still colliding become exceptions
+
+// Fixed-width integers packed back to back in 64-bit words; also read as a plain
+// bit string by bits()
+class PackedArray{
+    public:
+    PackedArray() : m_width(0), m_count(0){}
+    PackedArray(long count, int width) : m_words((count * width + 63) / 64 + 1, 0), m_width(width), m_count(count){}
+    long size() const {return m_count;}
+    int width() const {return m_width;}
+    uint64_t get(long index) const {return bits(index * m_width, m_width);}
+    void set(long index, uint64_t value);
+    // count (at most 64) bits starting at bit position, lowest bit first
+    uint64_t bits(long position, int count) const {
+        if (count == 0)
+            return 0;
+        long word = position >> 6;
+        int shift = position & 63;
+        uint64_t value = m_words[word] >> shift;
+        if (shift + count > 64)
+            value |= m_words[word + 1] << (64 - shift);
+        return count == 64 ? value : value & ((1ULL << count) - 1);
+    }
+    size_t bytes() const {return m_words.capacity() * sizeof(uint64_t);}
+    private:
+    vector<uint64_t> m_words;
+    int  m_width;
+    long m_count;
+};
+
+// A bit vector with the number of set bits before every 512-bit block, so
+// rank() costs one table read and at most eight popcounts
+class RankedBits{
+    public:
+    RankedBits(){}
+    explicit RankedBits(vector<uint64_t>& words);
+    bool test(long bit) const {return (m_words[bit >> 6] >> (bit & 63)) & 1;}
+    // set bits before position bit
+    long rank(long bit) const;
+    long size() const {return m_words.size() * 64;}
+    size_t bytes() const {return (m_words.capacity() + m_blocks.capacity()) * sizeof(uint64_t);}
+    private:
+    vector<uint64_t> m_words;
+    vector<uint64_t> m_blocks;
+};
+
+// Minimal perfect hash in the BBHash style: level i is a bit array of
+// FROZENGAMMA times the keys still unplaced, a key goes to the first level where
+// no other unplaced key hashes to its bit, and its index is the rank of that bit
+// over all levels. About 3.7 bits per key for gamma 2, rank counts included.
+class MinimalPerfectHash{
+    public:
+    MinimalPerfectHash() : m_placed(0){}
+    // Builds over distinct 64-bit fingerprints; those still colliding after
+    // FROZENLEVELS levels are returned in leftover and get no index
+    void build(const vector<uint64_t>& fingerprints, vector<uint64_t>& leftover);
+    // Index in [0, placed()) of a built fingerprint; any index or -1 for others
+    long lookup(uint64_t fingerprint) const;
+    long placed() const {return m_placed;}
+    int levels() const {return m_levelStart.size();}
+    size_t bytes() const {return m_bits.bytes() + (m_levelStart.capacity() + m_levelSize.capacity()) * sizeof(long);}
+    private:
+    RankedBits   m_bits;        // all levels one after the other
+    vector<long> m_levelStart;  // first bit of each level
+    vector<long> m_levelSize;   // bits of each level
+    long         m_placed;
+};
+
+// Read-only copy of a DnaDb in a compact encoding for read-mostly replicas:
+// a minimal perfect hash over the distinct sequences, the sequences packed in 2
+// bits per base, and the smallest location ID of each sequence stored relative
+// to the smallest one of all. The further location IDs of the few sequences that
+// have several are kept as sorted varint deltas. A lookup computes one
+// fingerprint, reads one index and compares the stored key, with no probing.
+//
+//     FrozenDnaDb frozen(database);   // on the thread that writes database
+//     frozen.getDNA(sequence, location);
+//
+// Sequences with letters other than A, C, G and T, and the very rare ones the
+// perfect hash cannot place, are kept as plain strings in a sorted exception list.
+// A frozen table never changes, so any number of threads can read it.
+class FrozenDnaDb{
+    public:
+    friend class Grader;
+    friend class Tester;
+    explicit FrozenDnaDb(const DnaDb& db);
+    // Same as DnaDb::getDNA
+    const DNA getDNA(string sequence, int location) const;
+    // Entries (sequence and location ID) and distinct sequences
+    long size() const {return m_entries;}
+    long keys() const {return m_hash.placed() + (long)m_exceptions.size();}
+    key_mode_t getKeyMode() const {return m_keyMode;}
+    // Memory taken by the encoding
+    size_t bytes() const;
+    private:
+    struct Exception{
+        string      sequence;
+        vector<int> locations;  // sorted
+    };
+    key_mode_t         m_keyMode;
+    long               m_entries;
+    MinimalPerfectHash m_hash;
+    int                m_length;       // length of every packed sequence, -1 if they differ
+    PackedArray        m_bases;        // 2-bit codes of the packed sequences by index
+    PackedArray        m_baseStart;    // first base of each sequence, when m_length is -1
+    int                m_locationBase; // smallest location ID
+    PackedArray        m_locations;    // smallest location ID of each sequence - m_locationBase
+    RankedBits         m_hasMore;      // sequences with more location IDs, empty if none has
+    PackedArray        m_moreStart;    // first byte in m_deltas by rank in m_hasMore
+    vector<uint8_t>    m_deltas;       // varint differences of the further location IDs
+    vector<Exception>  m_exceptions;   // sorted by sequence
+
+    long find(const string& key) const;
+    bool hasLocation(long index, int location) const;
+};
+#endif
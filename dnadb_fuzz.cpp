@@ -0,0 +1,210 @@
+#include "dnadb_stress.h"
+#include "dnadb_repl.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+using namespace std;
+
+// libFuzzer entry point. The first byte of an input picks the target:
+//   0 - operations: every following 3 bytes are an operation on a small DnaDb,
+//       checked against the model of dnadb_stress.h like the stress harness does
+//   1 - importBinary of the remaining bytes as an export file
+//   2 - a DnaFollower reading the remaining bytes as a change stream
+// Any difference from the model or broken table invariant aborts.
+//
+// clang++ -std=c++17 -g -O1 -fsanitize=fuzzer,address,undefined dnadb.cpp dnadb_repl.cpp dnadb_fuzz.cpp -o dnadb_fuzz
+// ./dnadb_fuzz corpus/
+//
+// Without libFuzzer, -DDNADB_FUZZ_MAIN adds a main that runs the files given as
+// arguments, or a number of random inputs when there are none:
+// g++ -std=c++17 -O1 -g -fsanitize=address,undefined -DDNADB_FUZZ_MAIN dnadb.cpp dnadb_repl.cpp dnadb_fuzz.cpp -o dnadb_fuzz
+
+const int FUZZPOOL = 64;        // sequences the operations pick from
+const int FUZZVERIFY = 64;      // operations between two full comparisons
+
+enum fuzz_target_t {FUZZ_OPERATIONS, FUZZ_IMPORT, FUZZ_FOLLOW, FUZZ_TARGETS};
+
+static void check(bool ok, const string& failure){
+    if (!ok){
+        fprintf(stderr, "dnadb_fuzz: %s\n", failure.c_str());
+        abort();
+    }
+}
+
+// Short sequences over few letters, so the operations meet the same keys and
+// both strands of them often
+static const vector<string>& fuzzPool(){
+    static vector<string> pool;
+    if (pool.empty()){
+        const char letters[] = {'A', 'C', 'G', 'T', 'N'};
+        for (int i = 0; i < FUZZPOOL; i++){
+            string sequence;
+            for (int n = i; n > 0 || sequence.empty(); n /= 5)
+                sequence += letters[n % 5];
+            // and a few longer than one 32-base word
+            if (i % 16 == 15)
+                sequence = string(33, 'C') + sequence;
+            pool.push_back(sequence);
+        }
+    }
+    return pool;
+}
+
+static void fuzzOperations(const uint8_t* data, size_t size){
+    if (size < 1)
+        return;
+    // the first byte chooses the table
+    prob_t policy = (prob_t)(data[0] % 3);
+    key_mode_t mode = (data[0] & 4) ? CANONICAL : EXACT;
+    DiffTable table(MINPRIME, (data[0] & 8) ? clusterHash : stressHash, policy, mode);
+    if (data[0] & 16)
+        table.table().setRehashThreads(1);
+    const vector<string>& pool = fuzzPool();
+    string failure;
+    for (size_t at = 1; at + 3 <= size; at += 3){
+        // operation, sequence, location ID (a few of them out of range)
+        const string& sequence = pool[data[at + 1] % FUZZPOOL];
+        int location = MINLOCID - 2 + data[at + 2] % 12;
+        bool ok = true;
+        switch (data[at] % 8){
+            case 0: case 1: case 2:
+                ok = table.insert(sequence, location);
+                break;
+            case 3: case 4:
+                ok = table.remove(sequence, location);
+                break;
+            case 5:
+                ok = table.find(sequence, location);
+                break;
+            case 6:
+                ok = table.update(sequence, location, MINLOCID + data[at] / 8 % 10);
+                break;
+            default:
+                if (data[at] & 8)
+                    table.table().changeProbPolicy((prob_t)(data[at] / 16 % 3));
+                else
+                    table.table().purgeTombstones(data[at] / 16);
+        }
+        check(ok, table.failure());
+        if (table.operations() % FUZZVERIFY == 0)
+            check(table.verify(), table.failure());
+    }
+    check(table.verify(), table.failure());
+}
+
+// Writes the bytes to a temporary file, returns its descriptor or -1
+static int temporaryFile(const uint8_t* data, size_t size, string& path){
+    char name[] = "/tmp/dnadb_fuzz_XXXXXX";
+    int fd = mkstemp(name);
+    if (fd < 0)
+        return -1;
+    path = name;
+    if (size > 0 && write(fd, data, size) != (ssize_t)size){
+        close(fd);
+        unlink(name);
+        return -1;
+    }
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+// An export file may be cut short or hold anything, the load stops at the first
+// damaged record and counts exactly what it inserted
+static void fuzzImport(const uint8_t* data, size_t size){
+    string path, failure;
+    int fd = temporaryFile(data, size, path);
+    if (fd < 0)
+        return;
+    DnaDb table(MINPRIME, stressHash, QUADRATIC, CANONICAL);
+    long inserted = table.importBinary(path);
+    close(fd);
+    unlink(path.c_str());
+    check(inserted == -1 ? table.size() == 0 : inserted == table.size(), "importBinary returned " + to_string(inserted) +
+          " for a table of " + to_string(table.size()));
+    check(StressChecker::checkTable(table, failure), failure);
+}
+
+// Same for a change stream: the follower stops at the first bad frame
+static void fuzzFollow(const uint8_t* data, size_t size){
+    string path, failure;
+    int fd = temporaryFile(data, size, path);
+    if (fd < 0)
+        return;
+    DnaDb replica(MINPRIME, stressHash, LINEAR, EXACT);
+    DnaFollower follower(replica, fd);
+    long events = follower.run();
+    close(fd);
+    unlink(path.c_str());
+    check(events >= -1 && (events != 0 || follower.applied() == 0), "follower returned " + to_string(events));
+    check(StressChecker::checkTable(replica, failure), failure);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size){
+    if (size == 0)
+        return 0;
+    switch (data[0] % FUZZ_TARGETS){
+        case FUZZ_OPERATIONS:
+            fuzzOperations(data + 1, size - 1);
+            break;
+        case FUZZ_IMPORT:
+            fuzzImport(data + 1, size - 1);
+            break;
+        default:
+            fuzzFollow(data + 1, size - 1);
+    }
+    return 0;
+}
+
+#ifdef DNADB_FUZZ_MAIN
+#include <random>
+int main(int argc, char* argv[]){
+    if (argc > 1){
+        for (int i = 1; i < argc; i++){
+            FILE* file = fopen(argv[i], "rb");
+            if (file == nullptr){
+                fprintf(stderr, "cannot open %s\n", argv[i]);
+                return 1;
+            }
+            vector<uint8_t> input;
+            int c;
+            while ((c = fgetc(file)) != EOF)
+                input.push_back((uint8_t)c);
+            fclose(file);
+            LLVMFuzzerTestOneInput(input.data(), input.size());
+        }
+        printf("%d inputs ok\n", argc - 1);
+        return 0;
+    }
+    // random inputs; the valid export and stream headers give the parsers more to chew on
+    mt19937 random(1);
+    const int INPUTS = 20000;
+    for (int i = 0; i < INPUTS; i++){
+        vector<uint8_t> input(1 + random() % 3000);
+        for (uint8_t& byte : input)
+            byte = random();
+        input[0] = i % FUZZ_TARGETS;
+        if (input[0] == FUZZ_IMPORT && input.size() > 17){
+            const char magic[] = {'D', 'N', 'A', 'D', 'B', '\0', 1, 0};
+            copy(magic, magic + sizeof(magic), input.begin() + 1);
+            input[9] = random() % 32;
+            fill(input.begin() + 10, input.begin() + 17, 0);
+        }
+        if (input[0] == FUZZ_FOLLOW && input.size() > 25){
+            // magic, event count, first event 1, the rest of the input as payload
+            const char magic[] = {'D', 'N', 'A', 'R'};
+            unsigned int count = 1 + random() % 16;
+            unsigned long long first = 1, bytes = input.size() - 25;
+            copy(magic, magic + sizeof(magic), input.begin() + 1);
+            memcpy(&input[5], &count, sizeof(count));
+            memcpy(&input[9], &first, sizeof(first));
+            memcpy(&input[17], &bytes, sizeof(bytes));
+        }
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+    }
+    printf("%d random inputs ok\n", INPUTS);
+    return 0;
+}
+#endif
@@ -0,0 +1,393 @@
+#include "dnadb_ingest.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#ifndef DNADB_NO_ZLIB
+#include <zlib.h>
+#endif
+
+// Unbounded blocking queue, the number of items in flight is bounded by the
+// pools of buffers that are passed around between the stages
+template <class T>
+class BlockingQueue{
+    public:
+    void push(T item){
+        lock_guard<mutex> lock(m_mutex);
+        m_items.push_back(item);
+        m_ready.notify_one();
+    }
+    // Returns false once the queue is closed and drained
+    bool pop(T& item){
+        unique_lock<mutex> lock(m_mutex);
+        m_ready.wait(lock, [this]{return !m_items.empty() || m_closed;});
+        if (m_items.empty())
+            return false;
+        item = m_items.front();
+        m_items.pop_front();
+        return true;
+    }
+    void close(){
+        lock_guard<mutex> lock(m_mutex);
+        m_closed = true;
+        m_ready.notify_all();
+    }
+    private:
+    mutex              m_mutex;
+    condition_variable m_ready;
+    deque<T>           m_items;
+    bool               m_closed = false;
+};
+
+// A raw block of input handed from the reader to the parser
+struct Chunk{
+    vector<char> data;
+    size_t       length = 0;
+};
+
+// A batch of parsed records handed from the parser to the hasher and the inserter
+struct Batch{
+    vector<DNA>          records;
+    vector<unsigned int> hashes;
+};
+
+// Input file, either read straight from the descriptor or through zlib
+class Source{
+    public:
+    ~Source(){
+#ifndef DNADB_NO_ZLIB
+        if (m_gz) gzclose(m_gz);
+        else
+#endif
+        if (m_fd >= 0) ::close(m_fd);
+    }
+    bool open(const string& path){
+        m_fd = ::open(path.c_str(), O_RDONLY);
+        if (m_fd < 0)
+            return false;
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        unsigned char magic[2] = {0, 0};
+        bool gzipped = (pread(m_fd, magic, 2, 0) == 2 && magic[0] == 0x1f && magic[1] == 0x8b);
+        if (!gzipped)
+            return true;
+#ifndef DNADB_NO_ZLIB
+        m_gz = gzdopen(m_fd, "rb");
+        if (m_gz == nullptr)
+            return false;
+        gzbuffer(m_gz, 1 << 20);
+        return true;
+#else
+        return false; // built without gzip support
+#endif
+    }
+    // Returns the number of bytes read, 0 at the end of input and -1 on error
+    long read(char* buffer, size_t size){
+#ifndef DNADB_NO_ZLIB
+        if (m_gz)
+            return gzread(m_gz, buffer, (unsigned int)size);
+#endif
+        size_t total = 0;
+        // fill the whole buffer so the parser sees few, large chunks
+        while (total < size){
+            ssize_t n = ::read(m_fd, buffer + total, size - total);
+            if (n < 0)
+                return -1;
+            if (n == 0)
+                break;
+            total += n;
+        }
+        return (long)total;
+    }
+    private:
+    int    m_fd = -1;
+#ifndef DNADB_NO_ZLIB
+    gzFile m_gz = nullptr;
+#endif
+};
+
+// Cuts FASTA/FASTQ records out of a sliding window without allocating per record
+class RecordParser{
+    public:
+    RecordParser(const IngestOptions& options, BlockingQueue<Batch*>& freeBatches, BlockingQueue<Batch*>& fullBatches)
+        : m_options(options), m_freeBatches(freeBatches), m_fullBatches(fullBatches){}
+
+    // Appends a chunk to the window and consumes all complete records
+    void feed(const char* data, size_t length){
+        // Keep only the unconsumed tail of the previous chunk
+        if (m_begin > 0){
+            memmove(m_window.data(), m_window.data() + m_begin, m_end - m_begin);
+            m_end -= m_begin;
+            m_begin = 0;
+        }
+        if (m_window.size() < m_end + length + 1)
+            m_window.resize(m_end + length + 1);
+        memcpy(m_window.data() + m_end, data, length);
+        m_end += length;
+        m_begin = parse(false);
+    }
+    // Consumes what is left in the window and hands over the last batch
+    void finish(){
+        // a missing final newline would otherwise leave the last line incomplete
+        if (m_end > m_begin && m_window[m_end - 1] != '\n'){
+            m_window[m_end] = '\n';
+            m_end++;
+        }
+        m_begin = parse(true);
+        if (m_begin < m_end)
+            m_bad = true; // truncated record
+        if (m_batch){
+            m_batch->records.resize(m_count);
+            m_fullBatches.push(m_batch);
+            m_batch = nullptr;
+        }
+    }
+    bool bad() const {return m_bad;}
+    long records() const {return m_records;}
+
+    private:
+    const IngestOptions&   m_options;
+    BlockingQueue<Batch*>& m_freeBatches;
+    BlockingQueue<Batch*>& m_fullBatches;
+    vector<char> m_window;      // unconsumed input
+    size_t       m_begin = 0;   // first unconsumed byte
+    size_t       m_end = 0;     // end of valid data
+    string       m_scratch;     // joins multi-line FASTA sequences
+    Batch*       m_batch = nullptr;
+    int          m_count = 0;   // records in m_batch
+    long         m_records = 0;
+    bool         m_bad = false;
+
+    // Returns the end of the line starting at pos (position of '\n'), or nullptr
+    const char* lineEnd(const char* pos, const char* end) const {
+        return (const char*)memchr(pos, '\n', end - pos);
+    }
+    // Length of a line without a trailing '\r'
+    static size_t trimmed(const char* begin, const char* nl){
+        return (nl > begin && nl[-1] == '\r') ? nl - begin - 1 : nl - begin;
+    }
+
+    // Parses complete records, returns the offset of the first unconsumed byte
+    size_t parse(bool eof){
+        const char* base = m_window.data();
+        const char* pos = base + m_begin;
+        const char* end = base + m_end;
+        while (pos < end && !m_bad){
+            // skip empty lines between records
+            if (*pos == '\n' || *pos == '\r'){
+                pos++;
+                continue;
+            }
+            const char* next = nullptr;
+            if (*pos == '>')
+                next = parseFasta(pos, end, eof);
+            else if (*pos == '@')
+                next = parseFastq(pos, end);
+            else
+                m_bad = true;
+            if (next == nullptr)
+                break; // need more input
+            pos = next;
+        }
+        return pos - base;
+    }
+
+    const char* parseFasta(const char* pos, const char* end, bool eof){
+        const char* headerEnd = lineEnd(pos, end);
+        if (headerEnd == nullptr)
+            return nullptr;
+        // The record ends at the next line starting with '>' or at the end of input
+        const char* line = headerEnd + 1;
+        int lines = 0;
+        const char* firstLine = line;
+        const char* firstEnd = line;
+        while (true){
+            if (line == end){
+                if (!eof)
+                    return nullptr;
+                break;
+            }
+            if (*line == '>')
+                break;
+            const char* nl = lineEnd(line, end);
+            if (nl == nullptr)
+                return nullptr;
+            if (lines == 0)
+                firstEnd = nl;
+            lines++;
+            line = nl + 1;
+        }
+        const char* seq = firstLine;
+        size_t seqLen = (lines == 0) ? 0 : trimmed(firstLine, firstEnd);
+        if (lines > 1){
+            // multi-line sequence, join the lines in the reused scratch buffer
+            m_scratch.clear();
+            const char* p = firstLine;
+            while (p < line){
+                const char* nl = lineEnd(p, line);
+                m_scratch.append(p, trimmed(p, nl));
+                p = nl + 1;
+            }
+            seq = m_scratch.data();
+            seqLen = m_scratch.size();
+        }
+        emit(pos + 1, trimmed(pos + 1, headerEnd), seq, seqLen);
+        return line;
+    }
+
+    const char* parseFastq(const char* pos, const char* end){
+        // header, sequence, '+' separator and quality lines
+        const char* nl[4];
+        const char* p = pos;
+        for (int i = 0; i < 4; i++){
+            nl[i] = lineEnd(p, end);
+            if (nl[i] == nullptr)
+                return nullptr;
+            p = nl[i] + 1;
+        }
+        if (*(nl[1] + 1) != '+'){
+            m_bad = true;
+            return nullptr;
+        }
+        emit(pos + 1, trimmed(pos + 1, nl[0]), nl[0] + 1, trimmed(nl[0] + 1, nl[1]));
+        return p;
+    }
+
+    void emit(const char* header, size_t headerLen, const char* seq, size_t seqLen){
+        if (m_batch == nullptr){
+            m_freeBatches.pop(m_batch);
+            if ((int)m_batch->records.size() < m_options.batchSize)
+                m_batch->records.resize(m_options.batchSize);
+            m_count = 0;
+        }
+        DNA& dna = m_batch->records[m_count];
+        dna.setSequence(seq, seqLen);
+        dna.setLocID(m_options.locId(header, headerLen, m_records));
+        m_records++;
+        m_count++;
+        if (m_count == m_options.batchSize){
+            m_fullBatches.push(m_batch);
+            m_batch = nullptr;
+        }
+    }
+};
+
+int locIdFromHeader(const char* header, size_t length, long recordNum){
+    (void)recordNum;
+    size_t i = 0;
+    while (i < length && (header[i] < '0' || header[i] > '9'))
+        i++;
+    if (i == length)
+        return -1; // rejected by DnaDb::insert
+    long value = 0;
+    while (i < length && header[i] >= '0' && header[i] <= '9' && value <= MAXLOCID){
+        value = value * 10 + (header[i] - '0');
+        i++;
+    }
+    return (value > MAXLOCID) ? -1 : (int)value;
+}
+
+int locIdSequential(const char* header, size_t length, long recordNum){
+    (void)header;
+    (void)length;
+    return MINLOCID + (int)(recordNum % (MAXLOCID - MINLOCID + 1));
+}
+
+DnaIngest::DnaIngest(DnaDb& db, const IngestOptions& options)
+    : m_db(db), m_options(options){
+    if (m_options.bufferSize == 0) m_options.bufferSize = INGEST_BUFSIZE;
+    if (m_options.batchSize <= 0) m_options.batchSize = INGEST_BATCHSIZE;
+    if (m_options.queueDepth <= 0) m_options.queueDepth = INGEST_QDEPTH;
+    if (m_options.locId == nullptr) m_options.locId = locIdFromHeader;
+}
+
+bool DnaIngest::ingestFile(const string& path){
+    m_stats = IngestStats();
+    Source source;
+    if (!source.open(path))
+        return false;
+
+    // Buffers are recycled through the free queues, so memory stays bounded
+    vector<Chunk> chunks(m_options.queueDepth);
+    vector<Batch> batches(m_options.queueDepth * 2);
+    BlockingQueue<Chunk*> freeChunks, fullChunks;
+    BlockingQueue<Batch*> freeBatches, parsedBatches, hashedBatches;
+    for (size_t i = 0; i < chunks.size(); i++){
+        chunks[i].data.resize(m_options.bufferSize);
+        freeChunks.push(&chunks[i]);
+    }
+    for (size_t i = 0; i < batches.size(); i++)
+        freeBatches.push(&batches[i]);
+
+    atomic<bool> failed(false);
+    long bytes = 0;
+    RecordParser parser(m_options, freeBatches, parsedBatches);
+
+    thread reader([&]{
+        Chunk* chunk;
+        while (!failed && freeChunks.pop(chunk)){
+            long n = source.read(chunk->data.data(), chunk->data.size());
+            if (n <= 0){
+                if (n < 0) failed = true;
+                freeChunks.push(chunk);
+                break;
+            }
+            chunk->length = n;
+            bytes += n;
+            fullChunks.push(chunk);
+        }
+        fullChunks.close();
+    });
+
+    thread parserThread([&]{
+        Chunk* chunk;
+        while (fullChunks.pop(chunk)){
+            // after an error keep draining so the reader never blocks
+            if (!failed){
+                parser.feed(chunk->data.data(), chunk->length);
+                if (parser.bad()) failed = true;
+            }
+            freeChunks.push(chunk);
+        }
+        if (!failed){
+            parser.finish();
+            if (parser.bad()) failed = true;
+        }
+        parsedBatches.close();
+    });
+
+    const HashFnRef& hash = m_db.getHash();
+    thread hasher([&]{
+        Batch* batch;
+        while (parsedBatches.pop(batch)){
+            batch->hashes.resize(batch->records.size());
+            for (size_t i = 0; i < batch->records.size(); i++){
+                // in CANONICAL mode the hash is taken over the stored key
+                m_db.canonicalize(batch->records[i]);
+                batch->hashes[i] = hash(batch->records[i].m_sequence);
+            }
+            hashedBatches.push(batch);
+        }
+        hashedBatches.close();
+    });
+
+    // The table is not thread safe, all inserts happen on the calling thread
+    Batch* batch;
+    while (hashedBatches.pop(batch)){
+        m_stats.inserted += m_db.insertBatch(batch->records, batch->hashes);
+        freeBatches.push(batch);
+    }
+
+    reader.join();
+    parserThread.join();
+    hasher.join();
+    m_stats.bytes = bytes;
+    m_stats.records = parser.records();
+    m_stats.rejected = m_stats.records - m_stats.inserted;
+    return !failed;
+}
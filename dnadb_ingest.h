@@ -0,0 +1,50 @@
+#ifndef DNADB_INGEST_H
+#define DNADB_INGEST_H
+#include "dnadb.h"
+using namespace std;
+
+// maps a record header (without the leading '>' or '@') to a location ID
+typedef int (*locid_fn)(const char* header, size_t length, long recordNum);
+
+// Location ID taken from the first number found in the header, e.g. ">sample_123456"
+int locIdFromHeader(const char* header, size_t length, long recordNum);
+// Location IDs handed out sequentially starting at MINLOCID
+int locIdSequential(const char* header, size_t length, long recordNum);
+
+const size_t INGEST_BUFSIZE = 4 << 20;  // bytes requested per read call
+const int INGEST_BATCHSIZE = 4096;      // records per insert batch
+const int INGEST_QDEPTH = 4;            // buffers in flight between two stages
+
+struct IngestOptions{
+    size_t   bufferSize = INGEST_BUFSIZE;
+    int      batchSize = INGEST_BATCHSIZE;
+    int      queueDepth = INGEST_QDEPTH;
+    locid_fn locId = locIdFromHeader;
+};
+
+struct IngestStats{
+    long bytes = 0;     // bytes of (decompressed) input consumed
+    long records = 0;   // records parsed
+    long inserted = 0;  // records accepted by the table
+    long rejected = 0;  // duplicates or out-of-range location IDs
+};
+
+// Streams FASTA/FASTQ files (plain or gzip) into a DnaDb.
+// The work is split in four stages connected by bounded queues:
+//   reader thread  -> large read()/gzread() calls into recycled buffers
+//   parser thread  -> records are cut from the buffers in place
+//   hasher thread  -> sequences are canonicalized (CANONICAL tables) and hashed
+//   calling thread -> DnaDb::insertBatch()
+// The table itself is only touched by the calling thread.
+class DnaIngest{
+    public:
+    DnaIngest(DnaDb& db, const IngestOptions& options = IngestOptions());
+    // Returns false if the file cannot be opened, read or is not FASTA/FASTQ
+    bool ingestFile(const string& path);
+    const IngestStats& getStats() const {return m_stats;}
+    private:
+    DnaDb&        m_db;
+    IngestOptions m_options;
+    IngestStats   m_stats;
+};
+#endif
@@ -0,0 +1,177 @@
+#include "dnadb_repl.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <unistd.h>
+
+// Header of a frame, followed by bytes of records for count events numbered from first
+static const char REPLMAGIC[4] = {'D', 'N', 'A', 'R'};
+struct ReplHeader{
+    char               magic[4];
+    unsigned int       count;
+    unsigned long long first;
+    unsigned long long bytes;
+};
+static const size_t RECORDHEAD = 1 + 2 * sizeof(int) + sizeof(unsigned int);
+
+static bool writeAll(int fd, const char* data, size_t length){
+    while (length > 0){
+        ssize_t n = ::write(fd, data, length);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+// Reads exactly length bytes; 0 if the stream ended before the first, -1 on an error
+// or an end in the middle
+static int readAll(int fd, char* data, size_t length){
+    size_t done = 0;
+    while (done < length){
+        ssize_t n = ::read(fd, data + done, length - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 || (n == 0 && done > 0))
+            return -1;
+        if (n == 0)
+            return 0;
+        done += n;
+    }
+    return 1;
+}
+
+void ChangeLog::onChange(change_t type, const string& key, int location, int previous){
+    lock_guard<mutex> lock(m_mutex);
+    m_events.push_back(ChangeEvent{m_next++, type, location, previous, key});
+}
+
+unsigned long long ChangeLog::lastNumber() const{
+    lock_guard<mutex> lock(m_mutex);
+    return m_next - 1;
+}
+
+long ChangeLog::pending() const{
+    lock_guard<mutex> lock(m_mutex);
+    return m_events.size();
+}
+
+void ChangeLog::drain(vector<ChangeEvent>& events){
+    lock_guard<mutex> lock(m_mutex);
+    events.assign(make_move_iterator(m_events.begin()), make_move_iterator(m_events.end()));
+    m_events.clear();
+}
+
+long ChangeLog::ship(int fd){
+    long shipped = 0;
+    vector<char> frame;
+    while (true){
+        // copy a frame worth of events, the table may keep adding more meanwhile
+        size_t count;
+        ReplHeader header;
+        frame.resize(sizeof(header));
+        {
+            lock_guard<mutex> lock(m_mutex);
+            count = min(m_events.size(), (size_t)REPLBATCH);
+            if (count == 0)
+                return shipped;
+            header.first = m_events.front().number;
+            for (size_t i = 0; i < count; i++){
+                const ChangeEvent& event = m_events[i];
+                unsigned int length = event.key.size();
+                size_t at = frame.size();
+                frame.resize(at + RECORDHEAD + length);
+                char* record = frame.data() + at;
+                record[0] = (char)event.type;
+                memcpy(record + 1, &event.location, sizeof(int));
+                memcpy(record + 1 + sizeof(int), &event.previous, sizeof(int));
+                memcpy(record + 1 + 2 * sizeof(int), &length, sizeof(length));
+                memcpy(record + RECORDHEAD, event.key.data(), length);
+            }
+        }
+        memcpy(header.magic, REPLMAGIC, sizeof(header.magic));
+        header.count = count;
+        header.bytes = frame.size() - sizeof(header);
+        memcpy(frame.data(), &header, sizeof(header));
+        if (!writeAll(fd, frame.data(), frame.size()))
+            return -1;
+        // only ship() removes events, so the first count are still the ones written
+        lock_guard<mutex> lock(m_mutex);
+        m_events.erase(m_events.begin(), m_events.begin() + count);
+        shipped += count;
+    }
+}
+
+void DnaFollower::flushInserts(){
+    if (!m_inserts.empty())
+        m_replica.insertBatch(m_inserts);
+    m_inserts.clear();
+}
+
+long DnaFollower::applyBatch(){
+    ReplHeader header;
+    int status = readAll(m_fd, (char*)&header, sizeof(header));
+    if (status <= 0)
+        return status;
+    if (memcmp(header.magic, REPLMAGIC, sizeof(header.magic)) != 0 || header.count == 0 ||
+        header.bytes > REPLMAXFRAME || header.bytes < (unsigned long long)header.count * RECORDHEAD)
+        return -1;
+    // a later first event means some were lost
+    if (header.first > m_applied + 1)
+        return -1;
+    m_frame.resize(header.bytes);
+    if (readAll(m_fd, m_frame.data(), m_frame.size()) != 1)
+        return -1;
+
+    const char* record = m_frame.data();
+    const char* end = record + m_frame.size();
+    for (unsigned int i = 0; i < header.count; i++){
+        int location, previous;
+        unsigned int length;
+        // what was applied before a malformed record stays applied
+        if (end - record < (ptrdiff_t)RECORDHEAD){
+            flushInserts();
+            return -1;
+        }
+        change_t type = (change_t)record[0];
+        memcpy(&location, record + 1, sizeof(int));
+        memcpy(&previous, record + 1 + sizeof(int), sizeof(int));
+        memcpy(&length, record + 1 + 2 * sizeof(int), sizeof(length));
+        record += RECORDHEAD;
+        if ((size_t)(end - record) < length || type > CHANGE_UPDATE){
+            flushInserts();
+            return -1;
+        }
+        unsigned long long number = header.first + i;
+        // skip what the replica already has, e.g. from its bootstrap export
+        if (number > m_applied){
+            if (type == CHANGE_INSERT){
+                m_inserts.push_back(DNA(string(record, length), location));
+            }
+            else{
+                // the order matters from here on
+                flushInserts();
+                if (type == CHANGE_REMOVE)
+                    m_replica.remove(DNA(string(record, length), location));
+                else
+                    m_replica.updateLocId(DNA(string(record, length), previous), location);
+            }
+            m_applied = number;
+        }
+        record += length;
+    }
+    flushInserts();
+    return header.count;
+}
+
+long DnaFollower::run(){
+    long total = 0;
+    long applied;
+    while ((applied = applyBatch()) > 0)
+        total += applied;
+    return applied < 0 ? -1 : total;
+}
@@ -0,0 +1,82 @@
+#ifndef DNADB_REPL_H
+#define DNADB_REPL_H
+#include "dnadb.h"
+#include <deque>
+#include <mutex>
+using namespace std;
+
+const int REPLBATCH = 4096;                 // events ship() writes per frame
+const unsigned int REPLMAXFRAME = 64 << 20; // payload bytes a follower accepts in one frame
+
+// Replication of a DnaDb over any byte stream (pipe, Unix or TCP socket).
+//
+// Primary:  ChangeLog log;  primary.setChangeSink(&log);  ... log.ship(fd) now and then
+// Replica:  DnaFollower follower(replica, fd);  follower.run();
+//
+// Every change gets the next sequence number. ship() writes the pending events as
+// frames: a header with the number of the first event, then one record per event
+// (type u8, location i32, previous i32, key length u32, key bytes). The follower
+// applies a frame at a time, consecutive inserts as one insertBatch.
+//
+// To start a replica from a running primary, export it with exportBinary while no
+// change runs and note log.lastNumber() at that moment; importBinary the file into
+// the replica and construct the follower with that number as applied. Events up to
+// it are skipped, a jump past the next expected number is an error.
+
+struct ChangeEvent{
+    unsigned long long number;  // sequence number, consecutive from 1
+    change_t type;
+    int      location;          // location ID after the change
+    int      previous;          // location ID before a CHANGE_UPDATE
+    string   key;
+};
+
+// Ordered log of the changes of a table, fed as its ChangeSink. The table reports
+// changes on its own thread, another thread may drain or ship them.
+class ChangeLog : public ChangeSink{
+    public:
+    friend class Grader;
+    friend class Tester;
+    // first is the number given to the next event
+    ChangeLog(unsigned long long first = 1) : m_next(first){}
+    void onChange(change_t type, const string& key, int location, int previous);
+    // Number of the last event logged so far, first - 1 before any
+    unsigned long long lastNumber() const;
+    // Events not yet drained or shipped
+    long pending() const;
+    // Moves the pending events to events, oldest first
+    void drain(vector<ChangeEvent>& events);
+    // Writes the pending events to fd, returns how many or -1 if fd failed;
+    // events that were not written stay pending. One thread drains or ships.
+    long ship(int fd);
+    private:
+    mutable mutex       m_mutex;
+    deque<ChangeEvent>  m_events;
+    unsigned long long  m_next;     // number of the next event
+};
+
+// Applies the stream written by ChangeLog::ship to a replica table.
+// The replica should be left to the follower, its readers may use snapshots.
+class DnaFollower{
+    public:
+    friend class Grader;
+    friend class Tester;
+    // applied is the number of the last event the replica already contains
+    DnaFollower(DnaDb& replica, int fd, unsigned long long applied = 0)
+        : m_replica(replica), m_fd(fd), m_applied(applied){}
+    // Reads and applies one frame. Returns the number of events in it, 0 at the end
+    // of the stream, -1 on a read error, a malformed frame or a gap in the numbers
+    long applyBatch();
+    // Applies frames until the stream ends, returns the events read or -1
+    long run();
+    // Number of the last event applied
+    unsigned long long applied() const {return m_applied;}
+    private:
+    DnaDb&             m_replica;
+    int                m_fd;
+    unsigned long long m_applied;
+    vector<char>       m_frame;     // payload of the current frame
+    vector<DNA>        m_inserts;   // consecutive inserts collected for insertBatch
+    void flushInserts();
+};
+#endif
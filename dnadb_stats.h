@@ -0,0 +1,158 @@
+#ifndef DNADB_STATS_H
+#define DNADB_STATS_H
+#include <chrono>
+#include <iostream>
+#include <string>
+using namespace std;
+
+// Operation and table indexes of DnaDbStats::probeHist
+enum stat_op_t {OP_INSERT, OP_FIND, OP_REMOVE, OP_UPDATE, NUMOPS};
+enum stat_table_t {CURRTABLE, OLDTABLE, NUMTABLES};
+const char* const STATOPNAME[NUMOPS] = {"insert", "find", "remove", "update"};
+const char* const STATTABLENAME[NUMTABLES] = {"current", "old"};
+
+// HDR-style histogram: values below 2*SUBBUCKETS are counted exactly, larger ones
+// in SUBBUCKETS linear buckets per power of two (relative error below 1/SUBBUCKETS)
+const int SUBBITS = 3;
+const int SUBBUCKETS = 1 << SUBBITS;
+const int HISTBUCKETS = (64 - SUBBITS + 1) * SUBBUCKETS;
+
+class Histogram{
+    public:
+    Histogram(){clear();}
+    void clear(){
+        for (int i = 0; i < HISTBUCKETS; i++) m_count[i] = 0;
+        m_total = 0; m_sum = 0; m_max = 0;
+    }
+    void record(unsigned long long value){
+        m_count[bucketOf(value)]++;
+        m_total++;
+        m_sum += value;
+        if (value > m_max) m_max = value;
+    }
+    unsigned long long getCount() const {return m_total;}
+    unsigned long long getMax() const {return m_max;}
+    double getMean() const {return m_total ? (double)m_sum / m_total : 0.0;}
+    // Lower bound of the bucket holding the given percentile (0-100)
+    unsigned long long percentile(double pct) const {
+        if (m_total == 0) return 0;
+        unsigned long long rank = (unsigned long long)(pct / 100.0 * (m_total - 1)) + 1;
+        unsigned long long seen = 0;
+        for (int i = 0; i < HISTBUCKETS; i++){
+            seen += m_count[i];
+            if (seen >= rank) return lowerBound(i);
+        }
+        return m_max;
+    }
+    // Number of values counted in bucket i, for exporters that want the raw buckets
+    unsigned long long bucketCount(int i) const {return m_count[i];}
+    static int bucketOf(unsigned long long value){
+        if (value < 2 * SUBBUCKETS) return (int)value;
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - SUBBITS;
+        return (shift + 1) * SUBBUCKETS + (int)((value >> shift) & (SUBBUCKETS - 1));
+    }
+    static unsigned long long lowerBound(int bucket){
+        if (bucket < 2 * SUBBUCKETS) return bucket;
+        int shift = bucket / SUBBUCKETS - 1;
+        return (unsigned long long)(SUBBUCKETS + bucket % SUBBUCKETS) << shift;
+    }
+    private:
+    unsigned long long m_count[HISTBUCKETS];
+    unsigned long long m_total;
+    unsigned long long m_sum;
+    unsigned long long m_max;
+};
+
+// Snapshot returned by DnaDb::stats(). The gauges are always filled in; the
+// counters and histograms only when the library is built with DNADB_STATS.
+struct DnaDbStats{
+    bool      enabled = false;      // built with DNADB_STATS
+    // gauges
+    int       capacity = 0;         // buckets of the current table
+    int       size = 0;             // occupied buckets of the current table
+    int       deleted = 0;          // tombstones of the current table
+    int       oldCapacity = 0;      // buckets of the old table, 0 when not rehashing
+    int       oldSize = 0;          // entries still to be moved from the old table
+    long long probes = 0;           // buckets visited so far
+    // counters
+    long long rehashes = 0;         // rehash() calls
+    long long rehashNanos = 0;      // time spent in rehash() and incremental transfers
+    long long migrationSteps = 0;   // incremental transfer steps
+    long long migratedEntries = 0;  // entries moved from the old to the new table
+    long long purgedTombstones = 0; // tombstones freed by purge sweeps
+    // buckets visited per operation, for the table where the operation ended
+    Histogram probeHist[NUMOPS][NUMTABLES];
+    // operation latencies in nanoseconds
+    Histogram insertLatency;
+    Histogram findLatency;          // lookups only (OP_FIND)
+    Histogram updateLatency;        // in-place value updates (OP_UPDATE)
+};
+
+// Records the lifetime of the object in a latency histogram, none if it is nullptr
+class StatTimer{
+    public:
+    StatTimer(Histogram& histogram) : m_histogram(&histogram), m_start(chrono::steady_clock::now()){}
+    StatTimer(Histogram* histogram) : m_histogram(histogram), m_start(chrono::steady_clock::now()){}
+    ~StatTimer(){
+        if (m_histogram != nullptr)
+            m_histogram->record(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - m_start).count());
+    }
+    private:
+    Histogram* m_histogram;
+    chrono::steady_clock::time_point m_start;
+};
+
+// Adds the lifetime of the object to a nanosecond counter
+class StatClock{
+    public:
+    StatClock(long long& nanos) : m_nanos(nanos), m_start(chrono::steady_clock::now()){}
+    ~StatClock(){
+        m_nanos += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - m_start).count();
+    }
+    private:
+    long long& m_nanos;
+    chrono::steady_clock::time_point m_start;
+};
+
+// Writes a histogram summary as "name.field value" lines
+inline void writeHistogram(ostream& sout, const string& name, const Histogram& hist){
+    sout << name << ".count " << hist.getCount() << "\n"
+         << name << ".mean " << hist.getMean() << "\n"
+         << name << ".p50 " << hist.percentile(50) << "\n"
+         << name << ".p90 " << hist.percentile(90) << "\n"
+         << name << ".p99 " << hist.percentile(99) << "\n"
+         << name << ".p999 " << hist.percentile(99.9) << "\n"
+         << name << ".max " << hist.getMax() << "\n";
+}
+
+// Writes the snapshot as "dnadb.<name> <value>" lines, easy to scrape for monitoring
+inline ostream& operator<<(ostream& sout, const DnaDbStats& stats){
+    sout << "dnadb.capacity " << stats.capacity << "\n"
+         << "dnadb.size " << stats.size << "\n"
+         << "dnadb.deleted " << stats.deleted << "\n"
+         << "dnadb.old_capacity " << stats.oldCapacity << "\n"
+         << "dnadb.old_size " << stats.oldSize << "\n"
+         << "dnadb.probes_total " << stats.probes << "\n";
+    if (!stats.enabled)
+        return sout;
+    sout << "dnadb.rehashes " << stats.rehashes << "\n"
+         << "dnadb.rehash_ns " << stats.rehashNanos << "\n"
+         << "dnadb.migration_steps " << stats.migrationSteps << "\n"
+         << "dnadb.migrated_entries " << stats.migratedEntries << "\n"
+         << "dnadb.purged_tombstones " << stats.purgedTombstones << "\n";
+    for (int op = 0; op < NUMOPS; op++)
+        for (int table = 0; table < NUMTABLES; table++)
+            writeHistogram(sout, string("dnadb.probes.") + STATOPNAME[op] + "." + STATTABLENAME[table], stats.probeHist[op][table]);
+    writeHistogram(sout, "dnadb.latency_ns.insert", stats.insertLatency);
+    writeHistogram(sout, "dnadb.latency_ns.find", stats.findLatency);
+    writeHistogram(sout, "dnadb.latency_ns.update", stats.updateLatency);
+    return sout;
+}
+
+#ifdef DNADB_STATS
+#define DNADB_STAT(statement) statement
+#else
+#define DNADB_STAT(statement)
+#endif
+#endif
@@ -0,0 +1,395 @@
+#include "dnadb_stress.h"
+#include "dnadb_repl.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unistd.h>
+using namespace std;
+
+// Randomized differential stress test: millions of mixed operations on a DnaDb
+// checked one by one against a std::unordered_multimap, for every collision
+// policy, both key modes, a good and a clustering hash function, with policy
+// switches, tombstone sweeps, batches and snapshots thrown in. The workload
+// alternates between growing and draining phases and empties the table every
+// four phases, so the table keeps resizing through all its sizes.
+// A DnaDb migrates in 4 steps by default, so in three of every four phases the
+// runs slow that down to thousands of steps (setTransferStep), and tens of
+// thousands of entries are found, removed, updated and batch inserted while both
+// tables are live. The same runs are repeated on a HashDb map whose policy
+// migrates slowly. A run fails if less than MINREHASHING of its operations met a
+// migration in progress. Every 50000 operations the whole table is compared with
+// the model and the bucket invariants are checked.
+//
+// With threads > 0 it runs the concurrent variant instead: one writer with
+// parallel resizes and a change log shipped to a follower replica, and reader
+// threads querying and exporting the snapshots the writer publishes. Build it
+// with -fsanitize=thread for that one.
+//
+// dnadb_stress [operations (default 2000000)] [threads (default 0)] [seed (default 1)]
+//
+// g++ -std=c++17 -O2 dnadb.cpp dnadb_repl.cpp dnadb_stress.cpp -o dnadb_stress -pthread
+// g++ -std=c++17 -O1 -g -fsanitize=thread dnadb.cpp dnadb_repl.cpp dnadb_stress.cpp -o dnadb_stress_tsan -pthread
+
+const int PHASEOPS = 25000;     // operations before the workload switches between growing and draining
+const int VERIFYOPS = 50000;    // operations between two full comparisons
+const int SNAPSHOTOPS = 20000;  // operations between two snapshot checks
+const int LOCIDS = 8;           // location IDs per sequence
+const int MAXLENGTH = 40;       // sequences are 1 to MAXLENGTH letters, so some span two 32-base words
+const int PUBLISHOPS = 2000;    // operations between two snapshots of the concurrent variant
+const int SHIPOPS = 500;        // operations between two ships of the change log
+const float SLOWTRANSFER = 0.00005; // transfer step of the slow phases of the DnaDb runs
+const double MINREHASHING = 0.15; // least share of operations that must meet a migration
+
+const char* POLICYNAME[] = {"QUADRATIC", "DOUBLEHASH", "LINEAR"};
+
+// Moves a resized table in about 2000 steps instead of 4 and splits small tables
+// over threads too, so the map runs spend most of their time mid-migration
+struct SlowMigration : TablePolicy{
+    static constexpr float TRANSFERSTEP = 0.0005;
+    static constexpr int PARALLELMIN = 256;
+};
+
+// Random sequences and operations of one run
+class Workload{
+    public:
+    Workload(int poolSize, unsigned int seed) : m_random(seed), m_growing(true), m_operations(0){
+        const char letters[] = {'A', 'C', 'G', 'T'};
+        for (int i = 0; i < poolSize; i++){
+            string sequence(1 + m_random() % MAXLENGTH, 'A');
+            // a few sequences with N, which the canonical keys compare as plain strings
+            for (char& letter : sequence)
+                letter = m_random() % 200 == 0 ? 'N' : letters[m_random() % 4];
+            m_pool.push_back(sequence);
+        }
+    }
+    const string& sequence() {return m_pool[m_random() % m_pool.size()];}
+    // Mostly valid location IDs, now and then one out of range
+    int location(){
+        int choice = m_random() % 200;
+        if (choice == 0)
+            return MINLOCID - 1;
+        if (choice == 1)
+            return MAXLOCID + 1;
+        return MINLOCID + choice % LOCIDS;
+    }
+    unsigned int next() {return m_random();}
+    // Applies one random operation, the mix follows the phase
+    bool step(DiffTable& table){
+        if (++m_operations % PHASEOPS == 0){
+            m_growing = !m_growing;
+            // now and then the table is emptied, so it grows through every size again
+            if (m_operations % (4 * PHASEOPS) == 0 && !table.removeAll())
+                return false;
+        }
+        DnaDb& db = table.table();
+        int choice = m_random() % 1000;
+        int insertShare = m_growing ? 600 : 50;
+        if (choice < insertShare)
+            return table.insert(sequence(), location());
+        choice -= insertShare;
+        if (choice < 650 - insertShare)
+            return table.remove(sequence(), location());
+        choice -= 650 - insertShare;
+        if (choice < 250)
+            return table.find(sequence(), location());
+        choice -= 250;
+        if (choice < 80)
+            return table.update(sequence(), location(), MINLOCID + m_random() % LOCIDS);
+        choice -= 80;
+        if (choice < 8){
+            vector<DNA> batch;
+            for (int i = m_random() % 64; i > 0; i--)
+                batch.push_back(DNA(sequence(), location()));
+            return table.insertBatch(batch);
+        }
+        choice -= 8;
+        if (choice < 5){
+            // takes effect with the next resize
+            db.changeProbPolicy((prob_t)(m_random() % 3));
+            return true;
+        }
+        choice -= 5;
+        if (choice < 4){
+            db.purgeTombstones(m_random() % 4096);
+            return true;
+        }
+        choice -= 4;
+        if (choice < 2){
+            db.compact();
+            return true;
+        }
+        switchRehashThreads(db);
+        return true;
+    }
+    // Same for a plain map, whose entries are only keys and values
+    template <class Policy>
+    bool step(DiffMap<Policy>& map){
+        if (++m_operations % PHASEOPS == 0)
+            m_growing = !m_growing;
+        int choice = m_random() % 1000;
+        int insertShare = m_growing ? 600 : 50;
+        if (choice < insertShare)
+            return map.insert(sequence(), m_random() % 1000);
+        choice -= insertShare;
+        if (choice < 650 - insertShare)
+            return map.remove(sequence());
+        choice -= 650 - insertShare;
+        if (choice < 330)
+            return map.find(sequence());
+        choice -= 330;
+        if (choice < 10)
+            map.table().changeProbPolicy((prob_t)(m_random() % 3));
+        else if (choice < 17)
+            map.table().purgeTombstones(m_random() % 4096);
+        else if (choice < 19)
+            map.table().compact();
+        else
+            switchRehashThreads(map.table());
+        return true;
+    }
+    // Turns parallel resizes on now and then, and off again at the next call
+    template <class Table>
+    void switchRehashThreads(Table& table){
+        if (table.getRehashThreads() > 0)
+            table.setRehashThreads(0);
+        else if (m_random() % 4 == 0)
+            table.setRehashThreads(1 + m_random() % 3);
+    }
+    private:
+    mt19937        m_random;
+    vector<string> m_pool;
+    bool           m_growing;   // inserts outweigh removes
+    long           m_operations;
+};
+
+// Takes a snapshot, keeps changing the table and checks the snapshot still
+// answers as the model did when it was taken
+static bool checkSnapshot(DiffTable& table, Workload& workload){
+    DnaSnapshot snapshot = table.table().snapshot();
+    DiffTable::Model model = table.model();
+    for (int i = 0; i < 500; i++)
+        if (!workload.step(table))
+            return false;
+    if (snapshot.size() != (long)model.size()){
+        fprintf(stderr, "snapshot size %ld, model %zu\n", snapshot.size(), model.size());
+        return false;
+    }
+    for (int i = 0; i < 500; i++){
+        DNA query(workload.sequence(), workload.location());
+        table.table().canonicalize(query);
+        pair<DiffTable::Model::const_iterator, DiffTable::Model::const_iterator> range = model.equal_range(query.getSequence());
+        bool expected = false;
+        for (DiffTable::Model::const_iterator it = range.first; it != range.second; ++it)
+            expected = expected || it->second == query.getLocId();
+        if (snapshot.getDNA(query.getSequence(), query.getLocId()).getUsed() != expected){
+            fprintf(stderr, "snapshot lookup of %s %d differs from the model\n", query.getSequence().c_str(), query.getLocId());
+            return false;
+        }
+    }
+    return true;
+}
+
+// Runs long enough to cover several phases must have spent MINREHASHING of their
+// operations mid-migration, or the slow transfers stopped working
+static bool enoughRehashing(long rehashing, long operations){
+    if (operations < 4 * PHASEOPS || rehashing >= MINREHASHING * operations)
+        return true;
+    fprintf(stderr, "  only %ld of %ld operations met a migration\n", rehashing, operations);
+    return false;
+}
+
+// One policy, key mode and hash function; returns false on the first difference
+static bool runSerial(prob_t policy, key_mode_t mode, hash_fn hash, const char* hashName, long operations, unsigned int seed){
+    // the clustering hash makes chains as long as the table, fewer sequences keep it affordable
+    Workload workload(hash == clusterHash ? 512 : 16384, seed);
+    DiffTable table(MINPRIME, hash, policy, mode);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    bool ok = true;
+    long rehashing = 0, peak = 0;
+    for (long i = 1; i <= operations && ok; i++){
+        // slow migrations, and the default steps in every fourth phase
+        if (i % PHASEOPS == 1)
+            table.table().setTransferStep(i / PHASEOPS % 4 == 3 ? TablePolicy::TRANSFERSTEP : SLOWTRANSFER);
+        ok = workload.step(table);
+        if (table.table().rehashing()){
+            rehashing++;
+            peak = max(peak, table.table().size());
+        }
+        if (ok && i % SNAPSHOTOPS == 0)
+            ok = checkSnapshot(table, workload);
+        if (ok && (i % VERIFYOPS == 0 || i == operations))
+            ok = table.verify();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    bool covered = enoughRehashing(rehashing, operations);
+    printf("%-10s %-9s %-7s %8ld ops, %5.1f%% while rehashing, %6ld entries at most mid-migration, %.1f s: %s\n",
+           POLICYNAME[policy], mode == EXACT ? "EXACT" : "CANONICAL", hashName, table.operations(),
+           100.0 * rehashing / max(1L, operations), peak, seconds, ok && covered ? "ok" : "FAILED");
+    if (!ok)
+        fprintf(stderr, "  %s (seed %u)\n", table.failure().c_str(), seed);
+    return ok && covered;
+}
+
+// A HashDb map with slow migrations, for one policy and hash function
+static bool runMap(prob_t policy, hash_fn hash, const char* hashName, long operations, unsigned int seed){
+    Workload workload(hash == clusterHash ? 512 : 4096, seed);
+    DiffMap<SlowMigration> map(MINPRIME, hash, policy);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    bool ok = true;
+    long rehashing = 0, peak = 0;
+    for (long i = 1; i <= operations && ok; i++){
+        ok = workload.step(map);
+        if (map.table().rehashing()){
+            rehashing++;
+            peak = max(peak, map.table().size());
+        }
+        if (ok && (i % VERIFYOPS == 0 || i == operations))
+            ok = map.verify();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    bool covered = enoughRehashing(rehashing, operations);
+    printf("%-10s %-9s %-7s %8ld ops, %5.1f%% while rehashing, %6ld entries at most mid-migration, %.1f s: %s\n",
+           POLICYNAME[policy], "map", hashName, map.operations(),
+           100.0 * rehashing / max(1L, operations), peak, seconds, ok && covered ? "ok" : "FAILED");
+    if (!ok)
+        fprintf(stderr, "  %s (seed %u)\n", map.failure().c_str(), seed);
+    return ok && covered;
+}
+
+// What the writer of the concurrent variant hands to the readers
+struct Published{
+    DnaSnapshot      snapshot;
+    DiffTable::Model model;
+};
+
+// Readers check the published snapshots while one writer keeps changing the table,
+// resizing it on several threads and shipping its changes to a follower
+static bool runConcurrent(long operations, int readers, unsigned int seed){
+    Workload workload(4096, seed);
+    DiffTable table(MINPRIME, stressHash, QUADRATIC, CANONICAL);
+    DnaDb& db = table.table();
+    db.setRehashThreads(2);
+    ChangeLog log;
+    db.setChangeSink(&log);
+    DnaDb replica(MINPRIME, stressHash, DOUBLEHASH, CANONICAL);
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+    long followed = 0;
+    thread follower([&replica, &followed, &fds]{
+        DnaFollower follower(replica, fds[0]);
+        followed = follower.run();
+    });
+
+    mutex publishMutex;
+    shared_ptr<const Published> published;
+    atomic<bool> stop(false), failed(false);
+    atomic<long> lookups(0);
+    vector<thread> threads;
+    for (int r = 0; r < readers; r++){
+        threads.push_back(thread([&, r]{
+            Workload queries(4096, seed);  // the same pool as the writer
+            string path = "dnadb_stress." + to_string(getpid()) + "." + to_string(r) + ".bin";
+            for (long round = 0; !stop && !failed; round++){
+                shared_ptr<const Published> view;
+                {
+                    lock_guard<mutex> lock(publishMutex);
+                    view = published;
+                }
+                if (view == nullptr){
+                    this_thread::yield();
+                    continue;
+                }
+                string key;
+                for (int i = 0; i < 100; i++){
+                    const string& sequence = queries.sequence();
+                    int location = queries.location();
+                    // the model is keyed on the canonical strand
+                    if (isCanonical(sequence.data(), sequence.size()))
+                        key = sequence;
+                    else
+                        reverseComplement(sequence.data(), sequence.size(), key);
+                    bool expected = false;
+                    pair<DiffTable::Model::const_iterator, DiffTable::Model::const_iterator> range = view->model.equal_range(key);
+                    for (DiffTable::Model::const_iterator it = range.first; it != range.second; ++it)
+                        expected = expected || it->second == location;
+                    DNA found = view->snapshot.getDNA(sequence, location);
+                    if (found.getUsed() != expected || (expected && found.getSequence() != key))
+                        failed = true;
+                }
+                lookups += 100;
+                if (round % 50 == 0){
+                    if (view->snapshot.exportBinary(path, 2) != view->snapshot.size())
+                        failed = true;
+                    remove((path + ".0").c_str());
+                    remove((path + ".1").c_str());
+                }
+            }
+        }));
+    }
+
+    bool ok = true;
+    for (long i = 1; i <= operations && ok && !failed; i++){
+        ok = workload.step(table);
+        if (i % PUBLISHOPS == 0){
+            shared_ptr<const Published> view(new Published{db.snapshot(), table.model()});
+            lock_guard<mutex> lock(publishMutex);
+            published = view;
+        }
+        if (i % SHIPOPS == 0)
+            ok = ok && log.ship(fds[1]) >= 0;
+    }
+    stop = true;
+    for (thread& reader : threads)
+        reader.join();
+    ok = ok && log.ship(fds[1]) >= 0;
+    close(fds[1]);
+    follower.join();
+    close(fds[0]);
+    db.setChangeSink(nullptr);
+    ok = ok && table.verify();
+
+    // the replica holds the same entries as the primary
+    DiffTable::Model entries;
+    DnaCursor cursor(replica);
+    while (cursor.next())
+        entries.emplace(cursor.get().getSequence(), cursor.get().getLocId());
+    bool replicated = followed == (long)log.lastNumber() && entries == table.model();
+    printf("concurrent: %ld ops, %d readers, %ld snapshot lookups, %ld changes replicated: %s\n",
+           table.operations(), readers, lookups.load(), followed, ok && !failed && replicated ? "ok" : "FAILED");
+    if (!ok)
+        fprintf(stderr, "  %s (seed %u)\n", table.failure().c_str(), seed);
+    if (failed)
+        fprintf(stderr, "  a snapshot answered differently from the model (seed %u)\n", seed);
+    if (!replicated)
+        fprintf(stderr, "  the replica differs from the primary (seed %u)\n", seed);
+    return ok && !failed && replicated;
+}
+
+int main(int argc, char* argv[]){
+    long operations = argc > 1 ? atol(argv[1]) : 2000000;
+    int threads = argc > 2 ? atoi(argv[2]) : 0;
+    unsigned int seed = argc > 3 ? (unsigned int)atol(argv[3]) : 1;
+    if (threads > 0)
+        return runConcurrent(operations, threads, seed) ? 0 : 1;
+
+    prob_t policies[] = {QUADRATIC, DOUBLEHASH, LINEAR};
+    key_mode_t modes[] = {EXACT, CANONICAL};
+    bool ok = true;
+    // 12 DnaDb runs and 6 map runs share the operations
+    for (int clustered = 0; clustered < 2; clustered++){
+        hash_fn hash = clustered ? clusterHash : stressHash;
+        const char* hashName = clustered ? "cluster" : "good";
+        for (key_mode_t mode : modes)
+            for (prob_t policy : policies)
+                ok = runSerial(policy, mode, hash, hashName, operations / 18, seed) && ok;
+        for (prob_t policy : policies)
+            ok = runMap(policy, hash, hashName, operations / 18, seed) && ok;
+    }
+    return ok ? 0 : 1;
+}
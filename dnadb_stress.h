@@ -0,0 +1,259 @@
+#ifndef DNADB_STRESS_H
+#define DNADB_STRESS_H
+#include "dnadb.h"
+#include <algorithm>
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+using namespace std;
+
+// Shared by the stress harness (dnadb_stress.cpp) and the fuzz targets
+// (dnadb_fuzz.cpp): a DnaDb run side by side with a std::unordered_multimap
+// that models it, plus checks of the table internals.
+
+// Same hash function as the driver and the tests
+inline unsigned int stressHash(string str){
+    unsigned int val = 0;
+    for (size_t i = 0; i < str.length(); i++)
+        val = val * 33 + str[i];
+    return val;
+}
+
+// A poor hash that maps most sequences of a length to a few values, so the
+// probe chains get long and overlap
+inline unsigned int clusterHash(string str){
+    unsigned int val = str.length() * 16;
+    if (!str.empty())
+        val += str[0] & 15;
+    return val;
+}
+
+// Structural checks that need the internals of a table, HashDb makes this class a
+// friend for them. Every bucket of the current table must count exactly the
+// chains of the entries stored in it, and the size counters must match the buckets.
+class StressChecker{
+    public:
+    template <class Table>
+    static bool checkTable(const Table& db, string& failure){
+        vector<int> passing(db.m_currentCap, 0);
+        int used = 0, deleted = 0;
+        for (int index = 0; index < db.m_currentCap; index++){
+            const typename Table::Slot& slot = db.m_currentTable[index];
+            if (slot.state == SLOT_DELETED)
+                deleted++;
+            if (slot.state != SLOT_USED)
+                continue;
+            used++;
+            int step = 0;
+            for (; step < db.m_currentCap && probeIndex(slot.hash, step, db.m_currentCap, db.m_currProbing) != index; step++)
+                passing[probeIndex(slot.hash, step, db.m_currentCap, db.m_currProbing)]++;
+            if (step == db.m_currentCap || slot.hash != db.getHash()(slot.key)){
+                failure = "bucket " + to_string(index) + " is not on the probe sequence of its entry";
+                return false;
+            }
+        }
+        for (int index = 0; index < db.m_currentCap; index++){
+            if (db.m_currentTable[index].passing != passing[index]){
+                failure = "bucket " + to_string(index) + " counts " + to_string(db.m_currentTable[index].passing) +
+                          " chains, " + to_string(passing[index]) + " run through it";
+                return false;
+            }
+        }
+        if (db.m_currentSize != used + deleted || db.m_currNumDeleted != deleted){
+            failure = "size counters " + to_string(db.m_currentSize) + "/" + to_string(db.m_currNumDeleted) +
+                      ", buckets " + to_string(used + deleted) + "/" + to_string(deleted);
+            return false;
+        }
+        return true;
+    }
+};
+
+// A DnaDb driven together with its model. Every operation is applied to both
+// and returns false, with failure() describing it, when the results differ.
+class DiffTable{
+    public:
+    typedef unordered_multimap<string, int> Model;
+    DiffTable(int size, hash_fn hash, prob_t probing, key_mode_t mode)
+        : m_db(size, hash, probing, mode), m_operations(0){}
+    DnaDb& table() {return m_db;}
+    const Model& model() const {return m_model;}
+    const string& failure() const {return m_failure;}
+    // Operations applied so far
+    long operations() const {return m_operations;}
+
+    bool insert(const string& sequence, int location){
+        string key = keyOf(sequence);
+        bool expected = location >= MINLOCID && location <= MAXLOCID && locate(key, location) == m_model.end();
+        if (expected)
+            m_model.emplace(key, location);
+        return agree("insert", sequence, location, m_db.insert(DNA(sequence, location)), expected);
+    }
+    bool insertBatch(const vector<DNA>& batch){
+        int expected = 0;
+        for (const DNA& dna : batch){
+            string key = keyOf(dna.getSequence());
+            if (dna.getLocId() >= MINLOCID && dna.getLocId() <= MAXLOCID && locate(key, dna.getLocId()) == m_model.end()){
+                m_model.emplace(key, dna.getLocId());
+                expected++;
+            }
+        }
+        int inserted = m_db.insertBatch(batch);
+        m_operations++;
+        if (inserted != expected)
+            return fail("insertBatch of " + to_string(batch.size()) + " inserted " + to_string(inserted) +
+                        ", expected " + to_string(expected));
+        return true;
+    }
+    bool remove(const string& sequence, int location){
+        Model::iterator it = locate(keyOf(sequence), location);
+        bool expected = it != m_model.end();
+        if (expected)
+            m_model.erase(it);
+        return agree("remove", sequence, location, m_db.remove(DNA(sequence, location)), expected);
+    }
+    bool find(const string& sequence, int location){
+        string key = keyOf(sequence);
+        bool expected = locate(key, location) != m_model.end();
+        DNA found = m_db.getDNA(sequence, location);
+        if (found.getUsed() && (found.getSequence() != key || found.getLocId() != location)){
+            m_operations++;
+            return fail("find " + sequence + " " + to_string(location) + " returned " +
+                        found.getSequence() + " " + to_string(found.getLocId()));
+        }
+        return agree("find", sequence, location, found.getUsed(), expected);
+    }
+    // updateLocId neither checks the new location ID nor rejects a duplicate, the model does the same
+    bool update(const string& sequence, int location, int newLocation){
+        Model::iterator it = locate(keyOf(sequence), location);
+        bool expected = it != m_model.end();
+        if (expected)
+            it->second = newLocation;
+        return agree("update", sequence, location, m_db.updateLocId(DNA(sequence, location), newLocation), expected);
+    }
+    // Removes every entry one by one, each remove checked like remove()
+    bool removeAll(){
+        vector<pair<string, int>> entries(m_model.begin(), m_model.end());
+        for (const pair<string, int>& entry : entries)
+            if (!remove(entry.first, entry.second))
+                return false;
+        return true;
+    }
+    // Compares the whole table with the model: size, every entry and the bucket invariants
+    bool verify(){
+        if (m_db.size() != (long)m_model.size())
+            return fail("size " + to_string(m_db.size()) + ", model " + to_string(m_model.size()));
+        vector<pair<string, int>> entries, expected(m_model.begin(), m_model.end());
+        DnaCursor cursor(m_db);
+        while (cursor.next())
+            entries.push_back(make_pair(cursor.get().getSequence(), cursor.get().getLocId()));
+        sort(entries.begin(), entries.end());
+        sort(expected.begin(), expected.end());
+        if (entries != expected)
+            return fail("the cursor walk differs from the model");
+        string failure;
+        if (!StressChecker::checkTable(m_db, failure))
+            return fail(failure);
+        return true;
+    }
+    private:
+    DnaDb  m_db;
+    Model  m_model;     // canonical key -> location IDs
+    string m_failure;
+    long   m_operations;
+
+    string keyOf(const string& sequence) const{
+        DNA dna(sequence, 0);
+        m_db.canonicalize(dna);
+        return dna.getSequence();
+    }
+    Model::iterator locate(const string& key, int location){
+        pair<Model::iterator, Model::iterator> range = m_model.equal_range(key);
+        for (Model::iterator it = range.first; it != range.second; ++it)
+            if (it->second == location)
+                return it;
+        return m_model.end();
+    }
+    bool agree(const char* operation, const string& sequence, int location, bool result, bool expected){
+        m_operations++;
+        if (result == expected)
+            return true;
+        ostringstream message;
+        message << operation << " " << sequence << " " << location << " returned " << result
+                << " at operation " << m_operations << (m_db.rehashing() ? " (rehashing)" : "");
+        return fail(message.str());
+    }
+    bool fail(const string& message){
+        if (m_failure.empty())
+            m_failure = message;
+        return false;
+    }
+};
+
+// A HashDb used as a plain map (insert, find, remove) together with its model.
+// The policy is a parameter, so a slow migration can keep most operations in the
+// middle of a rehash.
+template <class Policy>
+class DiffMap{
+    public:
+    typedef HashDb<string, int, HashFnRef, Policy> Table;
+    DiffMap(int size, hash_fn hash, prob_t probing) : m_db(size, HashFnRef(hash), probing), m_operations(0){}
+    Table& table() {return m_db;}
+    const string& failure() const {return m_failure;}
+    long operations() const {return m_operations;}
+
+    bool insert(const string& key, int value){
+        bool expected = m_model.emplace(key, value).second;
+        return agree("insert", key, m_db.insert(key, value), expected);
+    }
+    bool remove(const string& key){
+        bool expected = m_model.erase(key) > 0;
+        return agree("remove", key, m_db.remove(key), expected);
+    }
+    bool find(const string& key){
+        unordered_map<string, int>::iterator it = m_model.find(key);
+        const int* found = m_db.find(key);
+        if (found != nullptr && it != m_model.end() && *found != it->second){
+            m_operations++;
+            return fail("find " + key + " returned " + to_string(*found) + ", expected " + to_string(it->second));
+        }
+        return agree("find", key, found != nullptr, it != m_model.end());
+    }
+    bool verify(){
+        if (m_db.size() != (long)m_model.size())
+            return fail("size " + to_string(m_db.size()) + ", model " + to_string(m_model.size()));
+        vector<pair<string, int>> entries, expected(m_model.begin(), m_model.end());
+        typename Table::Cursor cursor(m_db);
+        while (cursor.next())
+            entries.push_back(make_pair(cursor.get().key, cursor.get().value));
+        sort(entries.begin(), entries.end());
+        sort(expected.begin(), expected.end());
+        if (entries != expected)
+            return fail("the cursor walk differs from the model");
+        string failure;
+        if (!StressChecker::checkTable(m_db, failure))
+            return fail(failure);
+        return true;
+    }
+    private:
+    Table  m_db;
+    unordered_map<string, int> m_model;
+    string m_failure;
+    long   m_operations;
+
+    bool agree(const char* operation, const string& key, bool result, bool expected){
+        m_operations++;
+        if (result == expected)
+            return true;
+        ostringstream message;
+        message << operation << " " << key << " returned " << result << " at operation " << m_operations
+                << (m_db.rehashing() ? " (rehashing)" : "");
+        return fail(message.str());
+    }
+    bool fail(const string& message){
+        if (m_failure.empty())
+            m_failure = message;
+        return false;
+    }
+};
+#endif
@@ -1,8 +1,19 @@
 #include "dnadb.h" 
+#include "dnadb_ingest.h"
+#include "dnadb_tiered.h"
+#include "dnadb_repl.h"
+#include "dnadb_frozen.h"
+#include "dnadb_kmer.h"
+#if __cplusplus >= 202002L
+#include "dnadb_async.h"
+#endif
 #include <math.h> 
+#include <cstdio>
 #include <algorithm> 
 #include <random> 
+#include <thread>
 #include <vector> 
+#include <unistd.h>
 using namespace std;
 
 // This class will contain methods to test the DnaDb functionality
@@ -14,6 +25,22 @@ class Tester{
     bool testFindDnaNormalCase();
     bool testRemoveDnaNormalCase();
     bool testRemoveDnaErrorCase();
+    bool testIngestFastaFastq();
+    bool testTombstonePurge();
+    bool testStats();
+    bool testCursorAndExport();
+    bool testGenericTable();
+    bool testCanonicalKeys();
+    bool testSnapshots();
+    bool testTieredStorage();
+    bool testParallelRehash();
+    bool testPlacement();
+    bool testReplication();
+    bool testFrozenTable();
+    bool testKmerTable();
+#if __cplusplus >= 202002L
+    bool testAsyncLookup();
+#endif
     
 };
 
@@ -26,6 +53,9 @@ unsigned int hashCode(const string str) {
     return val ;
 }
 
+// Generates a random DNA sequence of the given size
+string sequencer(int size, int seedNum);
+
 // Implements the test for inserting DNA objects into the database
 bool Tester::testInsertion(){
     // Define sample DNA sequences for insertion testing
@@ -42,8 +72,10 @@ bool Tester::testInsertion(){
     database.insert(gene2);
 
     // Verify if the inserted elements are at their expected positions 
-    bool bgene1= *database.m_currentTable[ database.m_hash(gene1.getSequence()) % database.m_currentCap ] == gene1;
-    bool bgene2= *database.m_currentTable[database.m_hash(gene2.getSequence())% database.m_currentCap] == gene2;
+    const DnaDb::Slot& slot1 = database.m_currentTable[ database.m_hash(gene1.getSequence()) % database.m_currentCap ];
+    const DnaDb::Slot& slot2 = database.m_currentTable[database.m_hash(gene2.getSequence())% database.m_currentCap];
+    bool bgene1= slot1.key == gene1.getSequence() && slot1.value == gene1.getLocId();
+    bool bgene2= slot2.key == gene2.getSequence() && slot2.value == gene2.getLocId();
     
     // Return true if both insertions are verified, false otherwise
     return (bgene1 && bgene2);
@@ -108,6 +140,692 @@ bool Tester::testRemoveDnaErrorCase(){
     return (database.remove(gene3)==false);
 }
 
+// Implements a test for streaming FASTA and FASTQ files into the database
+bool Tester::testIngestFastaFastq(){
+    const char* fastaPath = "dnadb_ingest_test.fa";
+    const char* fastqPath = "dnadb_ingest_test.fq";
+    FILE* fasta = fopen(fastaPath, "w");
+    FILE* fastq = fopen(fastqPath, "w");
+    if (fasta == nullptr || fastq == nullptr) return false;
+    // multi-line FASTA record, CRLF line ends and a missing final newline
+    fprintf(fasta, ">sample_100000\nGTTTT\nACGT\n>sample_100001\r\nAGCGC\r\n\n>sample_100002\nCAGTA");
+    fprintf(fastq, "@read 100003\nCATCT\n+\nIIIII\n@read 100004\nGAGCT\n+read 100004\nIIIII\n");
+    fclose(fasta);
+    fclose(fastq);
+
+    DnaDb database(MINPRIME, hashCode, LINEAR);
+    IngestOptions options;
+    options.bufferSize = 7; // forces records to straddle read buffers
+    options.batchSize = 2;
+    DnaIngest ingest(database, options);
+    bool result = ingest.ingestFile(fastaPath) && ingest.getStats().inserted == 3;
+    result = result && ingest.ingestFile(fastqPath) && ingest.getStats().inserted == 2;
+    remove(fastaPath);
+    remove(fastqPath);
+
+    result = result && database.getDNA("GTTTTACGT", 100000) == DNA("GTTTTACGT", 100000);
+    result = result && database.getDNA("AGCGC", 100001) == DNA("AGCGC", 100001);
+    result = result && database.getDNA("CAGTA", 100002) == DNA("CAGTA", 100002);
+    result = result && database.getDNA("CATCT", 100003) == DNA("CATCT", 100003);
+    result = result && database.getDNA("GAGCT", 100004) == DNA("GAGCT", 100004);
+    return result && !ingest.ingestFile("dnadb_no_such_file.fa");
+}
+
+// Implements a test for clearing deleted buckets in place under insert/remove churn
+bool Tester::testTombstonePurge(){
+    DnaDb database(MINPRIME, hashCode, QUADRATIC);
+    vector<DNA> live;
+    bool result = true;
+    // keep about 20 live entries while inserting and removing many more
+    for (int i = 0; i < 2000; i++){
+        DNA gene(sequencer(8, i), MINLOCID + i);
+        result = result && database.insert(gene);
+        live.push_back(gene);
+        if (live.size() > 20){
+            result = result && database.remove(live.front());
+            live.erase(live.begin());
+        }
+    }
+    // the churn must have been absorbed without growing the table
+    result = result && !database.rehashing() && database.m_currentCap == MINPRIME;
+
+    // the counters must match the buckets, on demand compaction clears all tombstones
+    database.compact();
+    int occupied = 0;
+    for (int i = 0; i < database.m_currentCap; i++)
+        if (database.m_currentTable[i].state != SLOT_EMPTY) occupied++;
+    result = result && database.m_currNumDeleted == 0 && occupied == database.m_currentSize;
+    result = result && database.m_currentSize == (int)live.size();
+    for (size_t i = 0; i < live.size(); i++)
+        result = result && database.getDNA(live[i].getSequence(), live[i].getLocId()) == live[i];
+    return result;
+}
+
+// Implements a test for the stats() snapshot and the histogram buckets
+bool Tester::testStats(){
+    // every value must land in a bucket whose lower bound is at most the value
+    // and within 1/SUBBUCKETS of it
+    bool result = true;
+    unsigned long long values[] = {0, 1, 15, 16, 17, 100, 1000, 123456789, ~0ULL};
+    for (unsigned long long value : values){
+        unsigned long long low = Histogram::lowerBound(Histogram::bucketOf(value));
+        result = result && low <= value && value - low <= value / SUBBUCKETS;
+    }
+    Histogram hist;
+    for (int i = 1; i <= 100; i++) hist.record(i);
+    result = result && hist.getCount() == 100 && hist.getMax() == 100;
+    result = result && hist.percentile(50) <= 50 && hist.percentile(50) >= 44;
+
+    DnaDb database(MINPRIME, hashCode, DOUBLEHASH);
+    for (int i = 0; i < 200; i++)
+        database.insert(DNA(sequencer(8, i), MINLOCID + i));
+    database.getDNA(sequencer(8, 0), MINLOCID);
+    database.updateLocId(DNA(sequencer(8, 1), MINLOCID + 1), MAXLOCID);
+    DnaDbStats stats = database.stats();
+    result = result && stats.capacity == database.m_currentCap && stats.size == database.m_currentSize;
+    result = result && stats.probes == database.probeCount() && stats.probes > 0;
+#ifdef DNADB_STATS
+    result = result && stats.enabled && stats.rehashes > 0 && stats.migratedEntries > 0;
+    result = result && stats.insertLatency.getCount() == 200 && stats.findLatency.getCount() == 1;
+    result = result && stats.updateLatency.getCount() == 1;
+    result = result && stats.probeHist[OP_FIND][CURRTABLE].getCount() == 1;
+#else
+    result = result && !stats.enabled;
+#endif
+    return result;
+}
+
+// Implements a test for walking the entries and exporting/reloading them
+bool Tester::testCursorAndExport(){
+    DnaDb database(MINPRIME, hashCode, QUADRATIC);
+    int count = 0;
+    // stop right after a rehash started so entries live in both tables
+    while (count < 40 || !database.rehashing()){
+        database.insert(DNA(sequencer(10, count), MINLOCID + count));
+        count++;
+    }
+    bool result = database.m_oldSize > 0;
+
+    // every entry exactly once, also when inserts happen during the walk
+    vector<int> seen(count, 0);
+    {
+        DnaCursor cursor(database);
+        int steps = 0;
+        while (cursor.next()){
+            if (cursor.get().getLocId() != MAXLOCID)
+                seen[cursor.get().getLocId() - MINLOCID]++;
+            if (steps++ == 3) database.insert(DNA("ACGT", MAXLOCID));
+        }
+        result = result && cursor.valid();
+    }
+    for (int i = 0; i < count; i++)
+        result = result && seen[i] == 1;
+
+    // binary export in one and in three files, reloaded into fresh tables
+    const char* path = "dnadb_export_test.bin";
+    result = result && database.exportBinary(path) == count + 1;
+    DnaDb reloaded(MINPRIME, hashCode, LINEAR);
+    result = result && reloaded.importBinary(path) == count + 1;
+    // a file cut in the middle of a record loads and counts the records before it
+    FILE* whole = fopen(path, "rb");
+    long bytes = 0;
+    if (whole && fseek(whole, 0, SEEK_END) == 0) bytes = ftell(whole);
+    if (whole) fclose(whole);
+    result = result && bytes > 0 && truncate(path, bytes / 2 + 3) == 0;
+    DnaDb truncated(MINPRIME, hashCode, QUADRATIC);
+    long partial = truncated.importBinary(path);
+    result = result && partial > 0 && partial < count + 1 && partial == truncated.size();
+    remove(path);
+    result = result && database.exportBinary(path, 3) == count + 1;
+    long parts = 0;
+    for (int i = 0; i < 3; i++){
+        string part = string(path) + "." + to_string(i);
+        parts += reloaded.importBinary(part);
+        remove(part.c_str());
+    }
+    result = result && parts == 0; // all of them are duplicates by now
+    for (int i = 0; i < count; i++){
+        DNA dna(sequencer(10, i), MINLOCID + i);
+        result = result && reloaded.getDNA(dna.getSequence(), dna.getLocId()) == dna;
+    }
+
+    // TSV export, one line per entry
+    const char* tsvPath = "dnadb_export_test.tsv";
+    result = result && database.exportTsv(tsvPath) == count + 1;
+    FILE* tsv = fopen(tsvPath, "r");
+    int lines = 0;
+    char line[64];
+    while (tsv && fgets(line, sizeof(line), tsv)) lines++;
+    if (tsv) fclose(tsv);
+    remove(tsvPath);
+    result = result && lines == count + 1;
+    return result && reloaded.importBinary(tsvPath) == -1;
+}
+
+// Per-sample metadata kept inline in the buckets of a generic table
+struct SampleInfo{
+    int   readCount;
+    float quality;
+    long  timestamp;
+};
+// Same hash as hashCode, as a functor the table can inline
+struct SequenceHash{
+    unsigned int operator()(const string& key) const {
+        unsigned int val = 0;
+        for (size_t i = 0; i < key.length(); i++)
+            val = val * 33 + key[i];
+        return val;
+    }
+};
+
+// Implements a test for a HashDb with a user supplied value type and hash functor
+bool Tester::testGenericTable(){
+    HashDb<string, SampleInfo, SequenceHash> table(MINPRIME);
+    bool result = true;
+    for (int i = 0; i < 300; i++)
+        result = result && table.insert(sequencer(16, i), SampleInfo{i, i * 0.5f, 1000L + i});
+    // a key is stored once, values are updated in place
+    result = result && !table.insert(sequencer(16, 0), SampleInfo{});
+    table.find(sequencer(16, 7))->readCount += 100;
+    for (int i = 0; i < 300; i += 2)
+        result = result && table.remove(sequencer(16, i));
+    result = result && table.size() == 150 && !table.remove(sequencer(16, 0));
+    for (int i = 0; i < 300; i++){
+        const SampleInfo* info = table.find(sequencer(16, i));
+        if (i % 2 == 0)
+            result = result && info == nullptr;
+        else
+            result = result && info != nullptr && info->quality == i * 0.5f && info->timestamp == 1000L + i &&
+                     info->readCount == (i == 7 ? 107 : i);
+    }
+    // the stored hash must be the functor's value
+    HashDb<string, SampleInfo, SequenceHash>::Cursor cursor(table);
+    while (cursor.next())
+        result = result && cursor.get().hash == SequenceHash()(cursor.get().key);
+    return result;
+}
+
+// Implements a test for the reverse complement aware key mode
+bool Tester::testCanonicalKeys(){
+    bool result = true;
+    string complement;
+    reverseComplement("GATTACAGATTACA", 14, complement);
+    result = result && complement == "TGTAATCTGTAATC";
+    reverseComplement("AACCGGTTACGTN", 13, complement);
+    result = result && complement == "NACGTAACCGGTT";
+    // the 2-bit kernel must agree with a plain string comparison, also across
+    // 32-base blocks, for palindromes and for sequences with other characters
+    mt19937 generator(5);
+    for (int i = 0; i < 2000; i++){
+        int length = 1 + generator() % 100;
+        string sequence = sequencer(length, i);
+        if (i % 5 == 0) sequence[generator() % length] = 'N';
+        reverseComplement(sequence.data(), sequence.size(), complement);
+        if (i % 7 == 0) sequence += complement; // palindrome
+        reverseComplement(sequence.data(), sequence.size(), complement);
+        result = result && isCanonical(sequence.data(), sequence.size()) == (sequence <= complement);
+    }
+
+    // both strands are one entry in a CANONICAL table, two in an EXACT one
+    DnaDb canonical(MINPRIME, hashCode, QUADRATIC, CANONICAL);
+    DnaDb exact(MINPRIME, hashCode, QUADRATIC);
+    string forward = "TTGCAGGATCCAAAGTTTGCACCTGAAACGATTAGGCAT";
+    string reverse;
+    reverseComplement(forward.data(), forward.size(), reverse);
+    result = result && canonical.insert(DNA(forward, MINLOCID)) && !canonical.insert(DNA(reverse, MINLOCID));
+    result = result && exact.insert(DNA(forward, MINLOCID)) && exact.insert(DNA(reverse, MINLOCID));
+    result = result && canonical.getDNA(forward, MINLOCID) == DNA(reverse, MINLOCID);
+    result = result && canonical.updateLocId(DNA(forward, MINLOCID), MINLOCID + 1);
+    result = result && canonical.getDNA(reverse, MINLOCID + 1).getSequence() == reverse;
+    result = result && canonical.remove(DNA(forward, MINLOCID + 1)) && canonical.size() == 0;
+
+    // batches through the ingest path, hashed after canonicalize()
+    vector<DNA> batch;
+    vector<unsigned int> hashes;
+    for (int i = 0; i < 100; i++){
+        DNA dna(sequencer(20, i), MINLOCID + i);
+        canonical.canonicalize(dna);
+        batch.push_back(dna);
+        hashes.push_back(hashCode(dna.getSequence()));
+    }
+    result = result && canonical.insertBatch(batch, hashes) == 100;
+    for (int i = 0; i < 100; i++){
+        string sequence = sequencer(20, i);
+        reverseComplement(sequence.data(), sequence.size(), reverse);
+        result = result && canonical.getDNA(reverse, MINLOCID + i).getLocId() == MINLOCID + i;
+    }
+    return result;
+}
+
+// Implements a test for snapshots read by another thread while the table changes
+bool Tester::testSnapshots(){
+    DnaDb database(MINPRIME, hashCode, QUADRATIC);
+    for (int i = 0; i < 500; i++)
+        database.insert(DNA(sequencer(12, i), MINLOCID + i));
+    DnaSnapshot snapshot = database.snapshot();
+
+    // the reader checks the snapshot while the writer removes, moves and adds
+    // entries, with several rehashes on the way
+    bool readerOk = true;
+    thread reader([&snapshot, &readerOk]{
+        for (int round = 0; round < 5; round++){
+            for (int i = 0; i < 500; i++)
+                readerOk = readerOk && snapshot.getDNA(sequencer(12, i), MINLOCID + i).getLocId() == MINLOCID + i;
+            readerOk = readerOk && snapshot.getDNA(sequencer(12, 600), MINLOCID + 600).getSequence().empty();
+        }
+        readerOk = readerOk && snapshot.exportBinary("dnadb_snapshot_test.bin") == 500;
+    });
+    bool result = true;
+    for (int i = 0; i < 500; i += 2)
+        result = result && database.remove(DNA(sequencer(12, i), MINLOCID + i));
+    for (int i = 1; i < 500; i += 2)
+        result = result && database.updateLocId(DNA(sequencer(12, i), MINLOCID + i), MAXLOCID);
+    for (int i = 500; i < 3000; i++)
+        database.insert(DNA(sequencer(12, i), MINLOCID + i));
+    reader.join();
+    result = result && readerOk && snapshot.size() == 500;
+
+    // the export holds the old version, the table the new one
+    DnaDb reloaded(MINPRIME, hashCode, LINEAR);
+    result = result && reloaded.importBinary("dnadb_snapshot_test.bin") == 500;
+    remove("dnadb_snapshot_test.bin");
+    for (int i = 0; i < 500; i++){
+        DNA dna(sequencer(12, i), MINLOCID + i);
+        result = result && reloaded.getDNA(dna.getSequence(), dna.getLocId()) == dna;
+        if (i % 2 == 0)
+            result = result && database.getDNA(dna.getSequence(), dna.getLocId()).getSequence().empty();
+        else
+            result = result && database.getDNA(dna.getSequence(), MAXLOCID).getLocId() == MAXLOCID;
+    }
+    // a snapshot taken in the middle of a rehash sees both tables
+    for (int i = 5000; !database.rehashing(); i++)
+        database.insert(DNA(sequencer(12, i), MINLOCID));
+    DnaSnapshot during = database.snapshot();
+    long size = database.size();
+    for (int i = 0; i < 100; i++)
+        database.insert(DNA(sequencer(12, 9000 + i), MINLOCID + i));
+    result = result && during.size() == size && !database.rehashing();
+    for (int i = 500; i < 3000; i++)
+        result = result && during.getDNA(sequencer(12, i), MINLOCID + i).getLocId() == MINLOCID + i;
+    return result;
+}
+
+// Implements a test for the tiered table: eviction to segment files, lookups that
+// fall through to disk, tombstones and compactions
+bool Tester::testTieredStorage(){
+    bool result = true;
+    long numSegments = 0;
+    vector<string> paths;
+    {
+        TieredOptions options;
+        options.hotCapacity = 200;
+        options.maxSegments = 3;
+        TieredDnaDb database(hashCode, options);
+        for (int i = 0; i < 2000; i++)
+            result = result && database.insert(DNA(sequencer(12, i), MINLOCID + i));
+        database.flush();
+        TieredStats stats = database.getStats();
+        result = result && database.hotSize() <= 200 && database.healthy();
+        result = result && stats.evicted >= 1800 && stats.segmentsWritten > 3 && stats.compactions > 0;
+        result = result && database.coldSegments() <= 3;
+        // duplicates are rejected in both tiers
+        result = result && !database.insert(DNA(sequencer(12, 5), MINLOCID + 5));
+        result = result && !database.insert(DNA(sequencer(12, 1999), MINLOCID + 1999));
+
+        // entries used often stay in memory while new ones push others out
+        for (int round = 0; round < 10; round++)
+            for (int i = 0; i < 50; i++)
+                result = result && database.getDNA(sequencer(12, i), MINLOCID + i).getLocId() == MINLOCID + i;
+        for (int i = 2000; i < 2100; i++)
+            database.insert(DNA(sequencer(12, i), MINLOCID + i));
+        long hotHits = database.getStats().hotHits;
+        for (int i = 0; i < 50; i++)
+            database.getDNA(sequencer(12, i), MINLOCID + i);
+        result = result && database.getStats().hotHits - hotHits == 50;
+
+        // removals and updates of cold entries survive the following compactions
+        for (int i = 1000; i < 1100; i++)
+            result = result && database.remove(DNA(sequencer(12, i), MINLOCID + i));
+        result = result && !database.remove(DNA(sequencer(12, 1000), MINLOCID + 1000));
+        result = result && database.updateLocId(DNA(sequencer(12, 1500), MINLOCID + 1500), MAXLOCID);
+        for (int i = 2100; i < 3000; i++)
+            database.insert(DNA(sequencer(12, i), MINLOCID + i));
+        result = result && database.insert(DNA(sequencer(12, 1000), MINLOCID + 1000));
+        database.flush();
+        for (int i = 0; i < 3000; i++){
+            DNA found = database.getDNA(sequencer(12, i), MINLOCID + i);
+            if ((i > 1000 && i < 1100) || i == 1500)
+                result = result && found.getSequence().empty();
+            else
+                result = result && found.getLocId() == MINLOCID + i;
+        }
+        result = result && database.getDNA(sequencer(12, 1500), MAXLOCID).getLocId() == MAXLOCID;
+        result = result && database.getStats().filterSkips > 0 && database.healthy();
+        numSegments = database.m_nextSegment;
+        for (long id = 0; id < numSegments; id++)
+            paths.push_back(database.segmentPath(id));
+    }
+    // a flush of cold deletions alone evicts nothing and leaves the access counts as they are
+    {
+        TieredOptions options;
+        options.hotCapacity = 200;
+        TieredDnaDb database(hashCode, options);
+        for (int i = 0; i < 400; i++)
+            database.insert(DNA(sequencer(12, i), MINLOCID + i));
+        database.flush();
+        const HotEntry* hot = database.m_hot.find(sequencer(12, 399));
+        for (int i = 0; i < 5; i++)
+            database.getDNA(sequencer(12, 399), MINLOCID + 399);
+        unsigned int hits = hot != nullptr ? database.hitsOf(*hot) : 0;
+        long evicted = database.getStats().evicted;
+        long removed = 0;
+        for (int i = 0; i < 400 && removed < 50; i++){
+            if (database.m_hot.find(sequencer(12, i)) == nullptr){
+                result = result && database.remove(DNA(sequencer(12, i), MINLOCID + i));
+                removed++;
+            }
+        }
+        result = result && hot != nullptr && hits == 5 && removed == 50;
+        result = result && database.m_pendingDeletes->size() == 0 && database.getStats().evicted == evicted;
+        result = result && database.hitsOf(*database.m_hot.find(sequencer(12, 399))) == hits;
+    }
+    // the segment files go away with the table
+    for (size_t i = 0; i < paths.size(); i++)
+        result = result && access(paths[i].c_str(), F_OK) != 0;
+    return result && numSegments > 0;
+}
+
+// Implements a test for resizes that move every entry at once on several threads
+bool Tester::testParallelRehash(){
+    bool result = true;
+    vector<string> sequences;
+    for (int i = 0; i < 60000; i++)
+        sequences.push_back(sequencer(12, i));
+    prob_t policies[] = {QUADRATIC, DOUBLEHASH, LINEAR};
+    for (prob_t policy : policies){
+        DnaDb database(MINPRIME, hashCode, policy);
+        database.setRehashThreads(4);
+        for (int i = 0; i < 60000; i++){
+            database.insert(DNA(sequences[i], MINLOCID + i % 1000));
+            result = result && !database.rehashing();
+        }
+        // half of the entries go again, the table shrinks on the way
+        for (int i = 0; i < 60000; i += 2)
+            result = result && database.remove(DNA(sequences[i], MINLOCID + i % 1000));
+        database.setRehashThreads(0);
+        for (int i = 0; i < 30000; i++)
+            database.remove(DNA(sequences[2 * i + 1], MINLOCID + (2 * i + 1) % 1000));
+        database.setRehashThreads(3);
+        for (int i = 0; i < 60000; i++)
+            database.insert(DNA(sequences[i], MINLOCID + i % 1000));
+        result = result && database.size() == 60000 && !database.rehashing();
+        for (int i = 0; i < 60000; i++)
+            result = result && database.getDNA(sequences[i], MINLOCID + i % 1000).getLocId() == MINLOCID + i % 1000;
+
+        // every bucket counts exactly the chains that run through it
+        vector<int> passing(database.m_currentCap, 0);
+        for (int index = 0; index < database.m_currentCap; index++){
+            const DnaDb::Slot& slot = database.m_currentTable[index];
+            if (slot.state != SLOT_USED)
+                continue;
+            for (int step = 0; probeIndex(slot.hash, step, database.m_currentCap, database.m_currProbing) != index; step++)
+                passing[probeIndex(slot.hash, step, database.m_currentCap, database.m_currProbing)]++;
+        }
+        for (int index = 0; index < database.m_currentCap; index++)
+            result = result && database.m_currentTable[index].passing == passing[index];
+    }
+    return result;
+}
+
+// Implements a test for tables placed on huge pages and interleaved over NUMA nodes
+bool Tester::testPlacement(){
+    bool result = true;
+    vector<string> sequences;
+    for (int i = 0; i < 20000; i++)
+        sequences.push_back(sequencer(10, i));
+    placement_t placements[] = {PLACE_HUGEPAGES, PLACE_INTERLEAVE, PLACE_HUGEPAGES | PLACE_INTERLEAVE};
+    for (placement_t placement : placements){
+        DnaDb database(MINPRIME, hashCode, QUADRATIC);
+        database.setPlacement(placement);
+        database.setRehashThreads(placement == PLACE_INTERLEAVE ? 0 : 2);
+        for (int i = 0; i < 20000; i++)
+            database.insert(DNA(sequences[i], MINLOCID + i));
+        result = result && database.getPlacement() == placement;
+        // the segments of a placed table are still copied on write one by one
+        DnaSnapshot snapshot = database.snapshot();
+        for (int i = 0; i < 20000; i += 2)
+            result = result && database.remove(DNA(sequences[i], MINLOCID + i));
+        for (int i = 0; i < 20000; i++){
+            result = result && snapshot.getDNA(sequences[i], MINLOCID + i).getLocId() == MINLOCID + i;
+            result = result && database.getDNA(sequences[i], MINLOCID + i).getSequence().empty() == (i % 2 == 0);
+        }
+    }
+    return result;
+}
+
+// Implements a test for a follower replaying the change stream of a table over a pipe
+bool Tester::testReplication(){
+    bool result = true;
+    vector<string> sequences;
+    for (int i = 0; i < 3000; i++)
+        sequences.push_back(sequencer(14, i));
+    DnaDb primary(MINPRIME, hashCode, QUADRATIC, CANONICAL);
+    DnaDb replica(MINPRIME, hashCode, QUADRATIC, CANONICAL);
+    ChangeLog log;
+    primary.setChangeSink(&log);
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+    long followed = 0;
+    thread follower([&replica, &followed, &fds]{
+        DnaFollower follower(replica, fds[0]);
+        followed = follower.run();
+    });
+    // only the changes that happened are logged
+    long changes = 0;
+    for (int i = 0; i < 3000; i++){
+        changes += primary.insert(DNA(sequences[i], MINLOCID + i % 7));
+        changes += primary.insert(DNA(sequences[i], MINLOCID + i % 7));
+        if (i % 500 == 499)
+            result = result && log.ship(fds[1]) > 0;
+    }
+    for (int i = 0; i < 3000; i += 3)
+        changes += primary.remove(DNA(sequences[i], MINLOCID + i % 7));
+    for (int i = 1; i < 3000; i += 3)
+        changes += primary.updateLocId(DNA(sequences[i], MINLOCID + i % 7), MINLOCID + 10);
+    changes += primary.remove(DNA(sequences[0], MINLOCID));
+    result = result && changes == 5000 && (long)log.lastNumber() == changes;
+    result = result && log.ship(fds[1]) > 0 && log.pending() == 0;
+    close(fds[1]);
+    follower.join();
+    close(fds[0]);
+    result = result && followed == changes && replica.size() == primary.size();
+    for (int i = 0; i < 3000; i++){
+        result = result && replica.getDNA(sequences[i], MINLOCID + i % 7) == primary.getDNA(sequences[i], MINLOCID + i % 7);
+        result = result && replica.getDNA(sequences[i], MINLOCID + 10) == primary.getDNA(sequences[i], MINLOCID + 10);
+    }
+
+    // a new replica starts from an export and follows the changes made after it
+    const char* path = "dnadb_repl_test.bin";
+    result = result && primary.exportBinary(path) == primary.size();
+    unsigned long long exported = log.lastNumber();
+    DnaDb late(MINPRIME, hashCode, QUADRATIC, CANONICAL);
+    result = result && late.importBinary(path) == primary.size();
+    remove(path);
+    for (int i = 2; i < 3000; i += 3)
+        primary.remove(DNA(sequences[i], MINLOCID + i % 7));
+    if (pipe(fds) != 0)
+        return false;
+    thread lateFollower([&late, &followed, &fds, exported]{
+        DnaFollower follower(late, fds[0], exported);
+        followed = follower.run();
+    });
+    result = result && log.ship(fds[1]) == 1000;
+    close(fds[1]);
+    lateFollower.join();
+    close(fds[0]);
+    result = result && followed == 1000 && late.size() == primary.size();
+    for (int i = 0; i < 3000; i++)
+        result = result && late.getDNA(sequences[i], MINLOCID + i % 7) == primary.getDNA(sequences[i], MINLOCID + i % 7);
+
+    // a follower that missed events refuses the stream
+    primary.insert(DNA(sequences[2], MINLOCID));
+    if (pipe(fds) != 0)
+        return false;
+    DnaFollower behind(late, fds[0], exported);
+    result = result && log.ship(fds[1]) == 1 && behind.applyBatch() == -1 && behind.applied() == exported;
+    close(fds[1]);
+    close(fds[0]);
+    primary.setChangeSink(nullptr);
+    return result;
+}
+
+// Implements a test for the read-only encoding with a perfect hash and packed sequences
+bool Tester::testFrozenTable(){
+    bool result = true;
+    // k-mers at one location each: fixed length, one location ID per sequence
+    DnaDb kmers(MINPRIME, hashCode, QUADRATIC, CANONICAL);
+    vector<string> sequences;
+    for (int i = 0; i < 20000; i++){
+        sequences.push_back(sequencer(21, i));
+        kmers.insert(DNA(sequences[i], MINLOCID + i * 37 % 5000));
+    }
+    FrozenDnaDb frozen(kmers);
+    result = result && frozen.size() == kmers.size() && frozen.keys() == kmers.size();
+    result = result && frozen.m_length == 21 && frozen.m_hasMore.size() == 0 && frozen.m_exceptions.empty();
+    // about 3 bits of perfect hash, 42 of sequence and 13 of location ID per key
+    result = result && frozen.bytes() < 9 * (size_t)frozen.keys();
+    string reverse;
+    for (int i = 0; i < 20000; i++){
+        int location = MINLOCID + i * 37 % 5000;
+        reverseComplement(sequences[i].data(), sequences[i].size(), reverse);
+        result = result && frozen.getDNA(reverse, location) == kmers.getDNA(sequences[i], location);
+        result = result && frozen.getDNA(sequences[i], location).getUsed();
+        result = result && !frozen.getDNA(sequences[i], location + 1).getUsed();
+        result = result && !frozen.getDNA(sequencer(22, i), location).getUsed();
+    }
+
+    // mixed lengths, several locations per sequence, letters other than ACGT
+    DnaDb mixed(MINPRIME, hashCode, LINEAR, EXACT);
+    for (int i = 0; i < 6000; i++){
+        string sequence = sequencer(1 + i % 70, i);
+        if (i % 100 == 0)
+            sequence[sequence.size() / 2] = 'N';
+        for (int j = 0; j <= i % 4; j++)
+            mixed.insert(DNA(sequence, MAXLOCID - i % 10 - 200 * j));
+    }
+    mixed.updateLocId(DNA(sequencer(1, 0), MAXLOCID), MAXLOCID + 5000);
+    FrozenDnaDb frozenMixed(mixed);
+    result = result && frozenMixed.size() == mixed.size() && frozenMixed.m_length == -1;
+    result = result && frozenMixed.m_hasMore.size() > 0 && !frozenMixed.m_exceptions.empty();
+    for (int i = 0; i < 6000; i++){
+        string sequence = sequencer(1 + i % 70, i);
+        if (i % 100 == 0)
+            sequence[sequence.size() / 2] = 'N';
+        for (int j = -1; j <= 4; j++){
+            DNA expected = mixed.getDNA(sequence, MAXLOCID - i % 10 - 200 * j);
+            DNA found = frozenMixed.getDNA(sequence, MAXLOCID - i % 10 - 200 * j);
+            result = result && found == expected && found.getUsed() == expected.getUsed();
+        }
+    }
+    result = result && frozenMixed.getDNA(sequencer(1, 0), MAXLOCID + 5000).getUsed();
+
+    // an empty table
+    DnaDb empty(MINPRIME, hashCode, DOUBLEHASH);
+    FrozenDnaDb frozenEmpty(empty);
+    return result && frozenEmpty.size() == 0 && !frozenEmpty.getDNA("ACGT", MINLOCID).getUsed();
+}
+
+// Implements a test for the packed k-mer table against a DnaDb with the same mode
+bool Tester::testKmerTable(){
+    bool result = true;
+    key_mode_t modes[] = {EXACT, CANONICAL};
+    for (key_mode_t mode : modes){
+        KmerDb<21> kmers(MINPRIME, hashCode, DOUBLEHASH, mode);
+        DnaDb database(MINPRIME, hashCode, DOUBLEHASH, mode);
+        // mostly 21-mers, some of other lengths and some with an N
+        vector<DNA> entries;
+        for (int i = 0; i < 8000; i++){
+            string sequence = sequencer(i % 10 == 0 ? 1 + i % 40 : 21, i);
+            if (i % 50 == 1)
+                sequence[7] = 'N';
+            entries.push_back(DNA(sequence, MINLOCID + i % 300));
+        }
+        entries.push_back(DNA(sequencer(21, 5), MAXLOCID + 1));
+        entries.push_back(entries[3]);
+        for (const DNA& dna : entries)
+            result = result && kmers.insert(dna) == database.insert(dna);
+        result = result && kmers.size() == database.size() && kmers.others().size() > 0;
+        result = result && kmers.kmers().size() > 6000;
+        string reverse;
+        for (int i = 0; i < 8000; i++){
+            reverseComplement(entries[i].getSequence().data(), entries[i].getSequence().size(), reverse);
+            for (int location : {entries[i].getLocId(), entries[i].getLocId() + 1}){
+                DNA expected = database.getDNA(reverse, location);
+                DNA found = kmers.getDNA(reverse, location);
+                result = result && found == expected && found.getUsed() == expected.getUsed();
+            }
+        }
+        // remove and update through both paths
+        for (int i = 0; i < 8000; i += 3){
+            result = result && kmers.remove(entries[i]) == database.remove(entries[i]);
+            result = result && kmers.updateLocId(entries[i + 1], MAXLOCID) == database.updateLocId(entries[i + 1], MAXLOCID);
+        }
+        kmers.changeProbPolicy(LINEAR);
+        result = result && kmers.size() == database.size();
+        for (int i = 0; i < 8000; i++){
+            for (int location : {entries[i].getLocId(), MAXLOCID}){
+                DNA expected = database.getDNA(entries[i].getSequence(), location);
+                DNA found = kmers.getDNA(entries[i].getSequence(), location);
+                result = result && found == expected && found.getUsed() == expected.getUsed();
+            }
+        }
+    }
+    result = result && KmerDb<4>::decode(0x1B) == "ACGT" && KmerDb<32>::decode(~0ULL) == string(32, 'T');
+    return result;
+}
+
+#if __cplusplus >= 202002L
+// A coroutine awaiting one asynchronous lookup
+AsyncTask awaitLookup(AsyncDnaDb& async, string sequence, int location, DNA& result){
+    result = co_await async.findAsync(sequence, location);
+}
+
+// Implements a test for interleaved coroutine lookups, also in the middle of a rehash
+bool Tester::testAsyncLookup(){
+    bool result = true;
+    key_mode_t modes[] = {EXACT, CANONICAL};
+    for (key_mode_t mode : modes){
+        DnaDb database(MINPRIME, hashCode, DOUBLEHASH, mode);
+        for (int i = 0; !database.rehashing() || i < 5000; i++)
+            database.insert(DNA(sequencer(14, i), MINLOCID + i % 100));
+        // hits in both tables, misses by sequence and by location ID
+        vector<DNA> queries;
+        for (int i = 0; i < 6000; i++)
+            queries.push_back(DNA(sequencer(14, i), MINLOCID + (i % 3 == 0 ? 101 : i % 100)));
+        LookupScheduler scheduler;
+        AsyncDnaDb async(database, scheduler);
+        vector<DNA> results;
+        async.findAll(queries, results);
+        for (size_t i = 0; i < queries.size(); i++){
+            DNA expected = database.getDNA(queries[i].getSequence(), queries[i].getLocId());
+            result = result && results[i] == expected && results[i].getUsed() == expected.getUsed();
+        }
+        result = result && database.rehashing();
+        // co_await from coroutines of our own
+        string reverse;
+        reverseComplement(queries[1].getSequence().data(), queries[1].getSequence().size(), reverse);
+        DNA first, second;
+        awaitLookup(async, queries[1].getSequence(), queries[1].getLocId(), first).spawn(scheduler);
+        awaitLookup(async, reverse, queries[1].getLocId(), second).spawn(scheduler);
+        scheduler.run();
+        result = result && first.getLocId() == queries[1].getLocId();
+        result = result && second.getSequence().empty() == (mode == EXACT);
+    }
+    return result;
+}
+#endif
+
 // Enum to define different types of random number distributions
 enum RANDOM {UNIFORMINT, UNIFORMREAL, NORMAL, SHUFFLE};
 
@@ -248,6 +966,22 @@ int main(){
     cout<<"Test a normal case of removing a dna from the database : "<<(tester.testRemoveDnaNormalCase()? "Passed": "Failed")<<endl;
     cout<<"Test an error case of removing a dna from the database : "<<(tester.testRemoveDnaErrorCase()? "Passed": "Failed")<<endl;
     cout<<"Test finding a dna that does not exist in the database : "<<(tester.testFindDnaErrorCase()? "Passed": "Failed")<<endl;
+    cout<<"Test streaming FASTA/FASTQ files into the database : "<<(tester.testIngestFastaFastq()? "Passed": "Failed")<<endl;
+    cout<<"Test clearing deleted buckets in place under churn : "<<(tester.testTombstonePurge()? "Passed": "Failed")<<endl;
+    cout<<"Test the statistics snapshot : "<<(tester.testStats()? "Passed": "Failed")<<endl;
+    cout<<"Test walking, exporting and reloading the entries : "<<(tester.testCursorAndExport()? "Passed": "Failed")<<endl;
+    cout<<"Test a generic table with inline metadata values : "<<(tester.testGenericTable()? "Passed": "Failed")<<endl;
+    cout<<"Test canonical keys for both strands of a sequence : "<<(tester.testCanonicalKeys()? "Passed": "Failed")<<endl;
+    cout<<"Test snapshots read while the table keeps changing : "<<(tester.testSnapshots()? "Passed": "Failed")<<endl;
+    cout<<"Test hot and cold tiers with spill to disk : "<<(tester.testTieredStorage()? "Passed": "Failed")<<endl;
+    cout<<"Test resizes moving all entries on several threads : "<<(tester.testParallelRehash()? "Passed": "Failed")<<endl;
+    cout<<"Test tables placed on huge pages and NUMA nodes : "<<(tester.testPlacement()? "Passed": "Failed")<<endl;
+    cout<<"Test a replica following the change stream : "<<(tester.testReplication()? "Passed": "Failed")<<endl;
+    cout<<"Test the frozen read-only encoding : "<<(tester.testFrozenTable()? "Passed": "Failed")<<endl;
+    cout<<"Test the packed k-mer table : "<<(tester.testKmerTable()? "Passed": "Failed")<<endl;
+#if __cplusplus >= 202002L
+    cout<<"Test interleaved coroutine lookups : "<<(tester.testAsyncLookup()? "Passed": "Failed")<<endl;
+#endif
     
     return 0; // Indicate successful execution of tests
 }
\ No newline at end of file
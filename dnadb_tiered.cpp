@@ -0,0 +1,594 @@
+#include "dnadb_tiered.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+const unsigned int HOTMAXHITS = 1 << 20; // access counts saturate here
+const int INDEXSTRIDE = 32;              // records per sparse index entry
+const int BLOOMBITS = 10;                // filter bits per record, about 1% false positives
+const int BLOOMHASHES = 7;               // filter bits set per record
+
+// One entry of the cold tier; a tombstone (deleted) hides the entry in older runs and segments
+struct ColdRecord{
+    string sequence;
+    int    location;
+    bool   deleted;
+};
+// Order of the runs and segment files: by sequence, then by location ID
+static bool keyLess(const ColdRecord& lhs, const ColdRecord& rhs){
+    int order = lhs.sequence.compare(rhs.sequence);
+    return order < 0 || (order == 0 && lhs.location < rhs.location);
+}
+static bool sameKey(const ColdRecord& lhs, const ColdRecord& rhs){
+    return lhs.location == rhs.location && lhs.sequence == rhs.sequence;
+}
+
+// 64-bit hash of an entry for the bloom filters (FNV-1a, then a splitmix finish)
+static unsigned long long coldHash(const string& sequence, int location){
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < sequence.size(); i++)
+        h = (h ^ (unsigned char)sequence[i]) * 0x100000001b3ULL;
+    h ^= (unsigned int)location;
+    h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27; h *= 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+// Bloom filter with double hashing: bit i of a key is h1 + i * h2
+class BloomFilter{
+    public:
+    void reset(long records){
+        m_numBits = max(64L, records * BLOOMBITS);
+        m_words.assign((m_numBits + 63) / 64, 0);
+    }
+    void add(unsigned long long hash){
+        unsigned long long h2 = (hash >> 32) | (hash << 32) | 1;
+        for (int i = 0; i < BLOOMHASHES; i++){
+            unsigned long long bit = (hash + i * h2) % m_numBits;
+            m_words[bit / 64] |= 1ULL << (bit % 64);
+        }
+    }
+    bool mayContain(unsigned long long hash) const {
+        unsigned long long h2 = (hash >> 32) | (hash << 32) | 1;
+        for (int i = 0; i < BLOOMHASHES; i++){
+            unsigned long long bit = (hash + i * h2) % m_numBits;
+            if ((m_words[bit / 64] & (1ULL << (bit % 64))) == 0)
+                return false;
+        }
+        return true;
+    }
+    private:
+    unsigned long long m_numBits = 64;
+    vector<unsigned long long> m_words;
+};
+
+// Segment file: a header, then the records in key order, each a uint32 sequence
+// length, an int32 location ID, a flag byte (1 for a tombstone) and the sequence.
+// The filter and the sparse index stay in memory; the file is removed with the segment.
+static const char SEGMENTMAGIC[6] = {'D', 'N', 'A', 'S', 'G', '\0'};
+static const unsigned short SEGMENTVERSION = 1;
+struct SegmentHeader{
+    char           magic[6];
+    unsigned short version;
+    long long      count;
+};
+const size_t RECORDHEADER = sizeof(unsigned int) + sizeof(int) + 1;
+
+struct ColdSegment{
+    string             path;
+    int                fd = -1;
+    long long          end = 0;    // file offset after the last record
+    long               count = 0;
+    BloomFilter        filter;
+    vector<ColdRecord> index;      // first record of every INDEXSTRIDE records
+    vector<long long>  offsets;    // file offset of every index record
+    ~ColdSegment(){
+        if (fd >= 0) ::close(fd);
+        if (!path.empty()) ::unlink(path.c_str());
+    }
+};
+
+// Runs waiting for the background thread and segment files, oldest first.
+// The state is never changed in place: writers publish a modified copy.
+struct ColdState{
+    vector<shared_ptr<const vector<ColdRecord>>> runs;
+    vector<shared_ptr<ColdSegment>>             segments;
+};
+
+// Writes sorted records with unique keys to a new segment file
+class SegmentWriter{
+    public:
+    SegmentWriter(const string& path, long expected) : m_segment(make_shared<ColdSegment>()){
+        m_segment->path = path;
+        m_segment->filter.reset(expected);
+        m_file = fopen(path.c_str(), "wb");
+        m_ok = m_file != nullptr;
+        if (m_ok){
+            setvbuf(m_file, nullptr, _IOFBF, EXPORTBUFSIZE);
+            SegmentHeader header = {};
+            m_ok = fwrite(&header, sizeof(header), 1, m_file) == 1;
+        }
+        m_offset = sizeof(SegmentHeader);
+    }
+    ~SegmentWriter(){
+        if (m_file != nullptr) fclose(m_file);
+    }
+    void add(const ColdRecord& record){
+        if (!m_ok)
+            return;
+        if (m_segment->count % INDEXSTRIDE == 0){
+            m_segment->index.push_back(record);
+            m_segment->offsets.push_back(m_offset);
+        }
+        m_segment->filter.add(coldHash(record.sequence, record.location));
+        unsigned int length = (unsigned int)record.sequence.size();
+        unsigned char flags = record.deleted ? 1 : 0;
+        m_ok = fwrite(&length, sizeof(length), 1, m_file) == 1 &&
+               fwrite(&record.location, sizeof(record.location), 1, m_file) == 1 &&
+               fwrite(&flags, 1, 1, m_file) == 1 &&
+               fwrite(record.sequence.data(), 1, length, m_file) == length;
+        m_offset += RECORDHEADER + length;
+        m_segment->count++;
+    }
+    // Completes the file and opens it for lookups, nullptr if anything failed
+    shared_ptr<ColdSegment> finish(){
+        if (m_ok){
+            SegmentHeader header;
+            memcpy(header.magic, SEGMENTMAGIC, sizeof(header.magic));
+            header.version = SEGMENTVERSION;
+            header.count = m_segment->count;
+            m_ok = fseek(m_file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, m_file) == 1;
+        }
+        if (m_file != nullptr && fclose(m_file) != 0)
+            m_ok = false;
+        m_file = nullptr;
+        if (m_ok){
+            m_segment->fd = ::open(m_segment->path.c_str(), O_RDONLY);
+            m_ok = m_segment->fd >= 0;
+        }
+        m_segment->end = m_offset;
+        if (!m_ok)
+            return nullptr; // the destructor of the segment removes the file
+        return m_segment;
+    }
+    private:
+    shared_ptr<ColdSegment> m_segment;
+    FILE*                   m_file;
+    long long               m_offset;
+    bool                    m_ok;
+};
+
+// Reads the records of a segment file in order, for compactions
+class SegmentReader{
+    public:
+    SegmentReader(const ColdSegment& segment) : m_left(segment.count){
+        m_file = fopen(segment.path.c_str(), "rb");
+        if (m_file != nullptr)
+            setvbuf(m_file, nullptr, _IOFBF, EXPORTBUFSIZE);
+        m_ok = m_file != nullptr && fseek(m_file, sizeof(SegmentHeader), SEEK_SET) == 0;
+    }
+    ~SegmentReader(){
+        if (m_file != nullptr) fclose(m_file);
+    }
+    // False at the end of the file or after a read error, see ok()
+    bool next(ColdRecord& record){
+        if (!m_ok || m_left == 0)
+            return false;
+        unsigned int length;
+        unsigned char flags;
+        m_ok = fread(&length, sizeof(length), 1, m_file) == 1 &&
+               fread(&record.location, sizeof(record.location), 1, m_file) == 1 &&
+               fread(&flags, 1, 1, m_file) == 1;
+        if (m_ok){
+            record.sequence.resize(length);
+            m_ok = length == 0 || fread(&record.sequence[0], 1, length, m_file) == length;
+            record.deleted = flags != 0;
+        }
+        m_left--;
+        return m_ok;
+    }
+    bool ok() const {return m_ok;}
+    private:
+    FILE* m_file;
+    long  m_left;   // records not read yet
+    bool  m_ok;
+};
+
+// Looks a key up in a segment: filter, sparse index, then one block read.
+// Returns 1 for a live record, 0 for a tombstone and -1 if the key is not there.
+static int findInSegment(const ColdSegment& segment, const ColdRecord& key, unsigned long long hash, TieredStats& stats){
+    if (!segment.filter.mayContain(hash)){
+        stats.filterSkips++;
+        return -1;
+    }
+    size_t block = upper_bound(segment.index.begin(), segment.index.end(), key, keyLess) - segment.index.begin();
+    if (block == 0)
+        return -1;
+    block--;
+    long long from = segment.offsets[block];
+    long long to = (block + 1 < segment.offsets.size()) ? segment.offsets[block + 1] : segment.end;
+    vector<char> buffer(to - from);
+    size_t done = 0;
+    while (done < buffer.size()){
+        ssize_t n = ::pread(segment.fd, buffer.data() + done, buffer.size() - done, from + done);
+        if (n <= 0)
+            return -1;
+        done += n;
+    }
+    stats.blockReads++;
+    size_t at = 0;
+    while (at + RECORDHEADER <= buffer.size()){
+        unsigned int length;
+        int location;
+        memcpy(&length, &buffer[at], sizeof(length));
+        memcpy(&location, &buffer[at + sizeof(length)], sizeof(location));
+        bool deleted = buffer[at + sizeof(length) + sizeof(location)] != 0;
+        const char* sequence = &buffer[at + RECORDHEADER];
+        if (at + RECORDHEADER + length > buffer.size())
+            return -1;
+        int order = key.sequence.compare(0, string::npos, sequence, length);
+        if (order == 0 && location == key.location)
+            return deleted ? 0 : 1;
+        if (order < 0 || (order == 0 && key.location < location))
+            return -1; // passed the place of the key
+        at += RECORDHEADER + length;
+    }
+    return -1;
+}
+
+// First segment of the next compaction, size-tiered: the newest segments are merged,
+// and older ones join as long as they are at most twice the size merged so far, so
+// a record is rewritten about log(cold entries / run size) times. At least two merge.
+static size_t mergeStart(const vector<shared_ptr<ColdSegment>>& segments){
+    size_t first = segments.size() - 1;
+    long merged = segments[first]->count;
+    while (first > 0 && (segments.size() - first < 2 || segments[first - 1]->count <= 2 * merged)){
+        first--;
+        merged += segments[first]->count;
+    }
+    return first;
+}
+
+static atomic<long> numInstances(0);
+
+TieredDnaDb::TieredDnaDb(hash_fn hash, const TieredOptions& options)
+    : m_options(options), m_hot(MINPRIME, HashFnRef(hash), options.probing),
+      m_pendingDeletes(new KeySet(MINPRIME, HashFnRef(hash))), m_round(0),
+      m_state(make_shared<ColdState>()), m_stop(false), m_busy(false), m_failed(false),
+      m_instance(numInstances++), m_nextSegment(0), m_segmentsWritten(0), m_compactions(0){
+    if (m_options.hotCapacity < 1) m_options.hotCapacity = 1;
+    if (m_options.evictShare <= 0 || m_options.evictShare > 1) m_options.evictShare = TIERED_EVICTSHARE;
+    if (m_options.maxSegments < 1) m_options.maxSegments = 1;
+    m_worker = thread(&TieredDnaDb::background, this);
+}
+
+TieredDnaDb::~TieredDnaDb(){
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_one();
+    m_worker.join();
+}
+
+// Inserts a DNA object into the hot table unless it is stored in either tier
+bool TieredDnaDb::insert(DNA dna){
+    int location = dna.getLocId();
+    if (location < MINLOCID || location > MAXLOCID)
+        return false;
+    const string& sequence = dna.getSequence();
+    unsigned int hashValue = m_hot.getHash()(sequence);
+    auto sameLocation = [location](const HotEntry& stored){return stored.location == location;};
+    if (m_hot.findHashed(OP_INSERT, sequence, hashValue, sameLocation) != nullptr ||
+        findCold(sequence, location, hashValue) == COLD_LIVE)
+        return false;
+    HotEntry entry;
+    entry.location = location;
+    entry.round = m_round;
+    m_hot.insertHashed(sequence, entry, hashValue, sameLocation);
+    evictIfFull();
+    return true;
+}
+
+// Removes a DNA object; a cold entry gets a tombstone with the next eviction
+bool TieredDnaDb::remove(DNA dna){
+    int location = dna.getLocId();
+    const string& sequence = dna.getSequence();
+    unsigned int hashValue = m_hot.getHash()(sequence);
+    if (m_hot.removeHashed(sequence, hashValue, [location](const HotEntry& stored){return stored.location == location;}))
+        return true;
+    if (findCold(sequence, location, hashValue) != COLD_LIVE)
+        return false;
+    dropCold(sequence, location, hashValue);
+    evictIfFull();
+    return true;
+}
+
+// Retrieves a DNA object, counting the access. An entry found in the cold tier
+// moves back into the hot table.
+const DNA TieredDnaDb::getDNA(string sequence, int location){
+    unsigned int hashValue = m_hot.getHash()(sequence);
+    auto sameLocation = [location](const HotEntry& stored){return stored.location == location;};
+    HotEntry* found = m_hot.findHashed(OP_FIND, sequence, hashValue, sameLocation);
+    if (found != nullptr){
+        touch(*found);
+        m_stats.hotHits++;
+        return DNA(sequence, location, true);
+    }
+    if (findCold(sequence, location, hashValue) != COLD_LIVE){
+        m_stats.misses++;
+        return DNA();
+    }
+    m_stats.coldHits++;
+    dropCold(sequence, location, hashValue);
+    HotEntry entry;
+    entry.location = location;
+    touch(entry);
+    m_hot.insertHashed(sequence, entry, hashValue, sameLocation);
+    evictIfFull();
+    return DNA(sequence, location, true);
+}
+
+// Updates the location ID of a stored DNA object; a cold entry moves to the hot table
+bool TieredDnaDb::updateLocId(DNA dna, int location){
+    int current = dna.getLocId();
+    const string& sequence = dna.getSequence();
+    unsigned int hashValue = m_hot.getHash()(sequence);
+    HotEntry* found = m_hot.findHashed(OP_UPDATE, sequence, hashValue,
+                                       [current](const HotEntry& stored){return stored.location == current;});
+    if (found != nullptr){
+        found->location = location;
+        touch(*found);
+        return true;
+    }
+    if (findCold(sequence, current, hashValue) != COLD_LIVE)
+        return false;
+    dropCold(sequence, current, hashValue);
+    HotEntry entry;
+    entry.location = location;
+    touch(entry);
+    // like DnaDb::updateLocId, the new location ID is not checked for duplicates
+    m_hot.insertHashed(sequence, entry, hashValue, [](const HotEntry&){return false;});
+    evictIfFull();
+    return true;
+}
+
+int TieredDnaDb::coldSegments() const{
+    lock_guard<mutex> lock(m_mutex);
+    return (int)m_state->segments.size();
+}
+
+void TieredDnaDb::flush(){
+    unique_lock<mutex> lock(m_mutex);
+    m_idle.wait(lock, [this]{
+        return m_failed || (!m_busy && m_state->runs.empty() && !needsCompaction(*m_state));
+    });
+}
+
+bool TieredDnaDb::healthy() const{
+    lock_guard<mutex> lock(m_mutex);
+    return !m_failed;
+}
+
+TieredStats TieredDnaDb::getStats() const{
+    TieredStats stats = m_stats;
+    lock_guard<mutex> lock(m_mutex);
+    stats.segmentsWritten = m_segmentsWritten;
+    stats.compactions = m_compactions;
+    return stats;
+}
+
+// The access count halves with every eviction round since the last access
+unsigned int TieredDnaDb::hitsOf(const HotEntry& entry) const{
+    unsigned int age = m_round - entry.round;
+    return (age >= 32) ? 0 : entry.hits >> age;
+}
+
+void TieredDnaDb::touch(HotEntry& entry) const{
+    entry.hits = min(hitsOf(entry) + 1, HOTMAXHITS);
+    entry.round = m_round;
+}
+
+// Looks an entry up in the cold tier: pending deletions, then the runs and the
+// segments from the newest to the oldest; the first record of the key decides
+TieredDnaDb::cold_t TieredDnaDb::findCold(const string& sequence, int location, unsigned int hashValue){
+    if (m_pendingDeletes->findHashed(OP_FIND, sequence, hashValue, [location](int stored){return stored == location;}) != nullptr)
+        return COLD_DELETED;
+    shared_ptr<const ColdState> state;
+    {
+        lock_guard<mutex> lock(m_mutex);
+        state = m_state;
+    }
+    ColdRecord key = {sequence, location, false};
+    for (size_t i = state->runs.size(); i-- > 0;){
+        const vector<ColdRecord>& run = *state->runs[i];
+        auto found = lower_bound(run.begin(), run.end(), key, keyLess);
+        if (found != run.end() && sameKey(*found, key))
+            return found->deleted ? COLD_DELETED : COLD_LIVE;
+    }
+    if (state->segments.empty())
+        return COLD_ABSENT;
+    unsigned long long hash = coldHash(sequence, location);
+    for (size_t i = state->segments.size(); i-- > 0;){
+        int found = findInSegment(*state->segments[i], key, hash, m_stats);
+        if (found >= 0)
+            return found ? COLD_LIVE : COLD_DELETED;
+    }
+    return COLD_ABSENT;
+}
+
+// Records the deletion of a live cold entry
+void TieredDnaDb::dropCold(const string& sequence, int location, unsigned int hashValue){
+    m_pendingDeletes->insertHashed(sequence, location, hashValue, [location](int stored){return stored == location;});
+}
+
+void TieredDnaDb::evictIfFull(){
+    long batch = max(1L, (long)(m_options.hotCapacity * m_options.evictShare));
+    if (m_hot.size() > m_options.hotCapacity || m_pendingDeletes->size() >= batch)
+        evict();
+}
+
+// Moves the least used entries out of the hot table, down to hotCapacity minus one
+// eviction batch, and hands them with the pending deletions as a sorted run to the
+// background thread
+void TieredDnaDb::evict(){
+    long batch = max(1L, (long)(m_options.hotCapacity * m_options.evictShare));
+    long count = m_hot.size() - max(0L, m_options.hotCapacity - batch);
+    vector<ColdRecord> run;
+    if (m_hot.size() > m_options.hotCapacity && count > 0){
+        // pick the victims by access count while the cursor keeps every entry in place
+        vector<pair<unsigned int, long>> candidates;
+        vector<unsigned int> hashes;
+        {
+            HotTable::Cursor pin(m_hot);
+            candidates.reserve(m_hot.size());
+            for (long slot = 0; slot < m_hot.slotCount(); slot++){
+                const HotTable::Slot* entry = m_hot.usedSlot(slot);
+                if (entry != nullptr)
+                    candidates.push_back(make_pair(hitsOf(entry->value), slot));
+            }
+            if (count < (long)candidates.size())
+                nth_element(candidates.begin(), candidates.begin() + count, candidates.end());
+            count = min(count, (long)candidates.size());
+            for (long i = 0; i < count; i++){
+                const HotTable::Slot* entry = m_hot.usedSlot(candidates[i].second);
+                run.push_back(ColdRecord{entry->key, entry->value.location, false});
+                hashes.push_back(entry->hash);
+            }
+        }
+        for (long i = 0; i < count; i++){
+            int location = run[i].location;
+            m_hot.removeHashed(run[i].sequence, hashes[i], [location](const HotEntry& stored){return stored.location == location;});
+        }
+        m_stats.evicted += count;
+        // only a round that moved entries out ages the access counts
+        m_round++;
+    }
+
+    {
+        KeySet::Cursor cursor(*m_pendingDeletes);
+        while (cursor.next())
+            run.push_back(ColdRecord{cursor.get().key, cursor.get().value, true});
+    }
+    m_pendingDeletes.reset(new KeySet(MINPRIME, m_hot.getHash()));
+    if (run.empty())
+        return;
+    // an entry deleted from the cold tier and stored again is evicted live: the
+    // live record sorts first and replaces the tombstone
+    sort(run.begin(), run.end(), [](const ColdRecord& lhs, const ColdRecord& rhs){
+        return keyLess(lhs, rhs) || (sameKey(lhs, rhs) && !lhs.deleted && rhs.deleted);
+    });
+    run.erase(unique(run.begin(), run.end(), sameKey), run.end());
+
+    {
+        lock_guard<mutex> lock(m_mutex);
+        shared_ptr<ColdState> next = make_shared<ColdState>(*m_state);
+        next->runs.push_back(make_shared<const vector<ColdRecord>>(std::move(run)));
+        m_state = next;
+    }
+    m_wake.notify_one();
+}
+
+bool TieredDnaDb::needsCompaction(const ColdState& state) const{
+    return (int)state.segments.size() > m_options.maxSegments;
+}
+
+// Background thread: merges segments once there are too many, otherwise writes the
+// runs to segment files, oldest first. Merging first bounds the segments a lookup
+// reads; runs wait in memory meanwhile. A failed write stops it, the runs stay in memory.
+void TieredDnaDb::background(){
+    unique_lock<mutex> lock(m_mutex);
+    while (true){
+        m_wake.wait(lock, [this]{
+            return m_stop || (!m_failed && (!m_state->runs.empty() || needsCompaction(*m_state)));
+        });
+        if (m_stop)
+            return;
+        shared_ptr<const ColdState> state = m_state;
+        bool compaction = needsCompaction(*state);
+        size_t first = compaction ? mergeStart(state->segments) : 0;
+        long id = m_nextSegment++;
+        m_busy = true;
+        lock.unlock();
+
+        shared_ptr<ColdSegment> segment = compaction ? compactSegments(state->segments, first, id)
+                                                     : writeSegment(*state->runs.front(), id);
+        lock.lock();
+        m_busy = false;
+        if (segment == nullptr)
+            m_failed = true;
+        else{
+            // only this thread removes runs and changes the segments, so the ones
+            // handled are still in place
+            shared_ptr<ColdState> next = make_shared<ColdState>(*m_state);
+            if (compaction){
+                next->segments.resize(first);
+                next->segments.push_back(segment);
+                m_compactions++;
+            }
+            else{
+                next->runs.erase(next->runs.begin());
+                next->segments.push_back(segment);
+                m_segmentsWritten++;
+            }
+            m_state = next;
+        }
+        m_idle.notify_all();
+    }
+}
+
+string TieredDnaDb::segmentPath(long id) const{
+    return m_options.directory + "/dnadb." + to_string(getpid()) + "." + to_string(m_instance) +
+           "." + to_string(id) + ".seg";
+}
+
+shared_ptr<ColdSegment> TieredDnaDb::writeSegment(const vector<ColdRecord>& records, long id) const{
+    SegmentWriter writer(segmentPath(id), (long)records.size());
+    for (size_t i = 0; i < records.size(); i++)
+        writer.add(records[i]);
+    return writer.finish();
+}
+
+// Merges the segments from first on into one; the newest record of every key wins.
+// Tombstones are dropped when the oldest segment takes part, nothing older remains.
+shared_ptr<ColdSegment> TieredDnaDb::compactSegments(const vector<shared_ptr<ColdSegment>>& all, size_t first, long id) const{
+    vector<shared_ptr<ColdSegment>> segments(all.begin() + first, all.end());
+    long total = 0;
+    for (size_t i = 0; i < segments.size(); i++)
+        total += segments[i]->count;
+    SegmentWriter writer(segmentPath(id), total);
+
+    size_t numInputs = segments.size();
+    vector<unique_ptr<SegmentReader>> readers;
+    vector<ColdRecord> heads(numInputs);
+    vector<bool> live(numInputs);
+    for (size_t i = 0; i < numInputs; i++){
+        readers.emplace_back(new SegmentReader(*segments[i]));
+        live[i] = readers[i]->next(heads[i]);
+    }
+    while (true){
+        // the smallest key; among equal keys the newest segment (highest index)
+        int smallest = -1;
+        for (size_t i = 0; i < numInputs; i++){
+            if (live[i] && (smallest < 0 || !keyLess(heads[smallest], heads[i])))
+                smallest = (int)i;
+        }
+        if (smallest < 0)
+            break;
+        ColdRecord winner = heads[smallest];
+        if (!winner.deleted || first > 0)
+            writer.add(winner);
+        for (size_t i = 0; i < numInputs; i++){
+            if (live[i] && sameKey(heads[i], winner))
+                live[i] = readers[i]->next(heads[i]);
+        }
+    }
+    for (size_t i = 0; i < numInputs; i++){
+        if (!readers[i]->ok())
+            return nullptr;
+    }
+    return writer.finish();
+}
@@ -0,0 +1,123 @@
+#ifndef DNADB_TIERED_H
+#define DNADB_TIERED_H
+#include "dnadb.h"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+using namespace std;
+
+struct ColdRecord;
+struct ColdSegment;
+struct ColdState;
+
+const long TIERED_HOTCAP = 1 << 20;     // entries kept in memory
+const float TIERED_EVICTSHARE = 0.25;   // share of the hot entries evicted at once
+const int TIERED_MAXSEGMENTS = 8;       // segment files that trigger a compaction
+
+struct TieredOptions{
+    string directory = ".";             // where the segment files are written
+    long   hotCapacity = TIERED_HOTCAP;
+    float  evictShare = TIERED_EVICTSHARE;
+    int    maxSegments = TIERED_MAXSEGMENTS;
+    prob_t probing = DEFPOLCY;          // collision policy of the hot table
+};
+
+struct TieredStats{
+    long hotHits = 0;       // lookups answered by the hot table
+    long coldHits = 0;      // lookups answered by the cold tier, the entry was promoted
+    long misses = 0;        // lookups of entries stored nowhere
+    long filterSkips = 0;   // segments skipped thanks to their bloom filter
+    long blockReads = 0;    // index blocks read from segment files
+    long evicted = 0;       // entries moved from the hot table to the cold tier
+    long segmentsWritten = 0;
+    long compactions = 0;
+};
+
+// Value of the hot table: the location ID plus an access count that halves with
+// every eviction round the entry sits through (see TieredDnaDb::hitsOf)
+struct HotEntry{
+    int          location = 0;
+    unsigned int hits = 0;
+    unsigned int round = 0; // eviction round of the last access
+};
+
+// A DnaDb that keeps the frequently used entries in a bounded in-memory table
+// and spills the others to disk. insert, remove, getDNA and updateLocId follow
+// DnaDb. It is a class of its own rather than a mode of DnaDb, since DnaDb is
+// one HashDb, and it leaves out what needs every entry in memory: keys are
+// always EXACT (no CANONICAL mode), and there is no getHashFn, snapshot, cursor,
+// export/import or ChangeSink.
+//
+// Hot tier: a HashDb of at most hotCapacity entries with access counters.
+// When it is full, the evictShare least used entries are moved out, together with
+// the pending deletions of cold entries, as one sorted run.
+// Cold tier: a log of sorted runs. A background thread writes every run to a
+// segment file with a bloom filter and a sparse index (kept in memory), and
+// merges the newest segments of similar size once there are more than maxSegments
+// of them; newer records shadow older ones and tombstones mark deletions.
+// getDNA falls through to the runs still in memory and then to the segments,
+// newest first, checking the bloom filter before reading an index block. An entry
+// found there is promoted back into the hot table.
+//
+// The segment files are a spill area, not a durable store: they are deleted
+// with the table. All calls must come from one thread.
+class TieredDnaDb{
+    public:
+    friend class Grader;
+    friend class Tester;
+    TieredDnaDb(hash_fn hash, const TieredOptions& options = TieredOptions());
+    ~TieredDnaDb();
+    TieredDnaDb(const TieredDnaDb&) = delete;
+    TieredDnaDb& operator=(const TieredDnaDb&) = delete;
+    bool insert(DNA dna);
+    bool remove(DNA dna);
+    const DNA getDNA(string sequence, int location);
+    bool updateLocId(DNA dna, int location);
+    // Entries in the hot table
+    long hotSize() const {return m_hot.size();}
+    // Segment files on disk
+    int coldSegments() const;
+    // Waits until every evicted entry is in a segment file and no compaction is due
+    void flush();
+    // False after a segment file could not be written, the entries stay in memory
+    bool healthy() const;
+    TieredStats getStats() const;
+    private:
+    typedef HashDb<string, HotEntry, HashFnRef> HotTable;
+    typedef HashDb<string, int, HashFnRef> KeySet;
+    enum cold_t {COLD_ABSENT, COLD_LIVE, COLD_DELETED};
+
+    TieredOptions m_options;
+    HotTable      m_hot;            // frequently used entries
+    unique_ptr<KeySet> m_pendingDeletes; // cold entries removed since the last eviction
+    unsigned int  m_round;          // eviction rounds so far, ages the access counts
+    TieredStats   m_stats;          // counters of the calling thread
+
+    // shared with the background thread
+    mutable mutex             m_mutex;
+    condition_variable        m_wake;    // work for the background thread
+    condition_variable        m_idle;    // the background thread finished a task
+    shared_ptr<const ColdState> m_state; // runs and segments, replaced as a whole
+    bool                      m_stop;
+    bool                      m_busy;    // the background thread is writing
+    bool                      m_failed;  // a segment could not be written
+    long                      m_instance;    // keeps the file names of two tables apart
+    long                      m_nextSegment;
+    long                      m_segmentsWritten;
+    long                      m_compactions;
+    thread                    m_worker;
+
+    unsigned int hitsOf(const HotEntry& entry) const;
+    void touch(HotEntry& entry) const;
+    cold_t findCold(const string& sequence, int location, unsigned int hashValue);
+    void dropCold(const string& sequence, int location, unsigned int hashValue);
+    void evictIfFull();
+    void evict();
+    bool needsCompaction(const ColdState& state) const;
+    void background();
+    string segmentPath(long id) const;
+    shared_ptr<ColdSegment> writeSegment(const vector<ColdRecord>& records, long id) const;
+    shared_ptr<ColdSegment> compactSegments(const vector<shared_ptr<ColdSegment>>& segments, size_t first, long id) const;
+};
+#endif
@@ -0,0 +1,1133 @@
+#ifndef HASHDB_H
+#define HASHDB_H
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "dnadb_stats.h"
+#include "hashdb_placement.h"
+using namespace std;
+class Grader;
+class Tester;
+const int MINPRIME = 101;   // Min size for hash table
+
+// Trial division, only used to build the prime table at compile time
+constexpr bool isPrimeNumber(unsigned long long number){
+    if (number < 2) return false;
+    if (number % 2 == 0) return number == 2;
+    for (unsigned long long i = 3; i * i <= number; i += 2)
+        if (number % i == 0) return false;
+    return true;
+}
+constexpr unsigned long long primeAtLeast(unsigned long long number){
+    while (!isPrimeNumber(number)) number++;
+    return number;
+}
+
+// Table capacities: starting at MINPRIME, every entry is the first prime
+// after twice the previous one, up to 2^32
+const int NUMPRIMES = 32;
+struct PrimeTable{
+    unsigned int value[NUMPRIMES];
+    int count;
+};
+constexpr PrimeTable makePrimeTable(){
+    PrimeTable table{};
+    unsigned long long prime = MINPRIME;
+    while (prime < (1ULL << 32) && table.count < NUMPRIMES){
+        table.value[table.count++] = (unsigned int)prime;
+        prime = primeAtLeast(2 * prime + 1);
+    }
+    return table;
+}
+constexpr PrimeTable PRIMES = makePrimeTable();
+
+// Largest table prime that fits the int capacity of a table
+constexpr int maxTablePrime(){
+    int i = PRIMES.count - 1;
+    while (PRIMES.value[i] > 2147483647u) i--;
+    return (int)PRIMES.value[i];
+}
+const int MAXPRIME = maxTablePrime(); // Max size for hash table
+
+// Smallest table prime >= number (binary search), clamped to [MINPRIME, MAXPRIME]
+constexpr int findNextPrime(long long number){
+    if (number >= MAXPRIME) return MAXPRIME;
+    int low = 0, high = PRIMES.count - 1;
+    while (low < high){
+        int mid = (low + high) / 2;
+        if (PRIMES.value[mid] < number) low = mid + 1;
+        else high = mid;
+    }
+    return (int)PRIMES.value[low];
+}
+static_assert(PRIMES.value[0] == MINPRIME && findNextPrime(0) == MINPRIME, "prime table must start at MINPRIME");
+static_assert(findNextPrime(MINPRIME + 1) > 2 * MINPRIME, "prime table must roughly double");
+
+enum prob_t {QUADRATIC, DOUBLEHASH, LINEAR}; // types of collision handling policy
+#define DEFPOLCY QUADRATIC
+
+// Resize and cleanup thresholds of a HashDb. A table can be tuned by passing
+// another struct with the same members as the Policy parameter.
+struct TablePolicy{
+    static constexpr float MAXLOAD = 0.5;     // load factor (deleted buckets included) that triggers a resize
+    static constexpr float GROWLOAD = 0.375;  // live load factor above which the resize grows the table,
+                                              // below it the tombstones are cleared in place instead
+    static constexpr float SHRINKLOAD = 0.125;// live load factor below which a delete-heavy table shrinks
+    static constexpr float MAXDELETED = 0.8;  // ratio of deleted buckets that triggers a cleanup
+    static constexpr int PURGESTEP = 16;      // buckets swept for tombstones by each insert/remove
+    static constexpr float TRANSFERSTEP = 0.25;// share of the old table moved by each transfer step
+    static constexpr int PARALLELMIN = 1 << 14;// entries below which a full transfer stays on one thread
+};
+
+enum slot_state_t : unsigned char {SLOT_EMPTY, SLOT_USED, SLOT_DELETED, SLOT_MOVED};
+
+// A bucket of a HashDb. Key and value are stored inline, next to the hash of the
+// key, so transfers and sweeps never call the hash function again.
+template <class Key, class Value>
+struct HashSlot{
+    Key           key{};
+    Value         value{};
+    unsigned int  hash = 0;
+    int           passing = 0;  // used entries whose probe sequence runs through this bucket,
+                                // a deleted bucket no entry runs through becomes empty again;
+                                // belongs to the bucket, not to the entry stored in it
+    unsigned char state = SLOT_EMPTY; // SLOT_MOVED only in the old table: the entry was
+                                      // transferred, but chains of the old table still pass
+};
+
+// Slots per segment of a SlotArray; a segment is the unit copied on write
+const int SEGMENTBITS = 10;
+const int SEGMENTSLOTS = 1 << SEGMENTBITS;
+
+// Bucket array split in fixed-size segments that copies can share. share() returns
+// a copy referencing the same segments; afterwards the first writable() access to a
+// segment still referenced by a copy clones it, so the copy never sees a change.
+// Copies are only made and written by the owner's thread, a copy may be read and
+// released from any thread.
+template <class Slot>
+class SlotArray{
+    public:
+    SlotArray() : m_cap(0){}
+    // Replaces the contents by cap empty buckets. Other placements than PLACE_DEFAULT
+    // take all segments from one SlotArena; if it cannot be mapped, operator new is used.
+    void allocate(int cap, placement_t placement = PLACE_DEFAULT){
+        release();
+        m_cap = cap;
+        shared_ptr<SlotArena<Slot>> arena;
+        if (placement != PLACE_DEFAULT){
+            arena = make_shared<SlotArena<Slot>>(cap, placement);
+            if (arena->slots() == nullptr)
+                arena.reset();
+        }
+        for (long first = 0; first < cap; first += SEGMENTSLOTS){
+            if (arena != nullptr){
+                // a control block per segment keeps use_count() meaningful for own()
+                m_segments.push_back(shared_ptr<Slot[]>(arena->slots() + first, [arena](Slot*){}));
+            }
+            else
+                m_segments.push_back(shared_ptr<Slot[]>(new Slot[segmentSize(first)]));
+            m_owned.push_back(true);
+        }
+    }
+    void release(){
+        m_segments.clear();
+        m_owned.clear();
+        m_cap = 0;
+    }
+    bool allocated() const {return m_cap > 0;}
+    int capacity() const {return m_cap;}
+    const Slot& operator[](long index) const {
+        return m_segments[index >> SEGMENTBITS][index & (SEGMENTSLOTS - 1)];
+    }
+    // The bucket for writing, copying its segment first if a snapshot shares it
+    Slot& writable(long index){
+        int segment = (int)(index >> SEGMENTBITS);
+        if (!m_owned[segment])
+            own(segment);
+        return m_segments[segment][index & (SEGMENTSLOTS - 1)];
+    }
+    SlotArray share(){
+        for (size_t i = 0; i < m_owned.size(); i++)
+            m_owned[i] = false;
+        return *this;
+    }
+    private:
+    int                        m_cap;
+    vector<shared_ptr<Slot[]>> m_segments;
+    vector<char>               m_owned;   // segment known to be referenced by this array only
+    long segmentSize(long first) const {return min<long>(SEGMENTSLOTS, m_cap - first);}
+    void own(int segment){
+        // a released snapshot leaves the segment to us, otherwise copy it
+        if (m_segments[segment].use_count() > 1){
+            long size = segmentSize((long)segment << SEGMENTBITS);
+            shared_ptr<Slot[]> copy(new Slot[size]);
+            for (long i = 0; i < size; i++)
+                copy[i] = m_segments[segment][i];
+            m_segments[segment] = copy;
+        }
+        m_owned[segment] = true;
+    }
+};
+
+// Matches every value, turns the multimap operations into map operations
+struct AnyValue{
+    template <class Value>
+    bool operator()(const Value&) const {return true;}
+};
+
+// Returns the bucket visited at the given step of the probe sequence
+inline int probeIndex(unsigned int hashValue, int step, int cap, prob_t probing){
+    long long home = hashValue % cap;
+    switch(probing){
+        case QUADRATIC:
+            return (int)((home + (long long)step * step) % cap);
+        case DOUBLEHASH:
+            {
+                unsigned int hash2 = 11 - (hashValue % 11); // Second hash function for double hashing
+                return (int)((home + (long long)step * hash2) % cap);
+            }
+        case LINEAR:
+        default:
+            return (int)((home + step) % cap);
+    }
+}
+
+// Open addressing hash table with incremental rehashing, the engine behind DnaDb.
+//   Key    - equality comparable, default constructible
+//   Value  - payload stored inline in the bucket, default constructible
+//   Hash   - functor, unsigned int operator()(const Key&) const; it is a type
+//            parameter so the compiler can inline it into the probe loops
+//   Policy - load factor thresholds, see TablePolicy
+// The same key may be stored with several values (DnaDb keeps a sequence at
+// several locations). The *Hashed operations take a predicate on the value that
+// picks the entry; insert, find and remove treat the table as a plain map.
+template <class Key, class Value, class Hash, class Policy = TablePolicy>
+class HashDb{
+    public:
+    typedef HashSlot<Key, Value> Slot;
+    class Cursor;
+    class Snapshot;
+    template <class Match> class Probe;
+    friend class Grader;
+    friend class Tester;
+    friend class StressChecker;
+    HashDb(int size, const Hash& hash = Hash(), prob_t probing = DEFPOLCY);
+    ~HashDb();
+    HashDb(const HashDb&) = delete;
+    HashDb& operator=(const HashDb&) = delete;
+    // Returns Load factor of the new table
+    float lambda() const;
+    // Returns the ratio of deleted buckets in the new table
+    float deletedRatio() const;
+    // Returns true while entries are still being moved from the old table
+    bool rehashing() const {return m_oldTable.allocated();}
+    // Returns the number of buckets visited by all operations so far
+    long long probeCount() const {return m_numProbes;}
+    // Returns the number of used entries in both tables
+    long size() const;
+    // Returns the table gauges plus, when built with DNADB_STATS, probe-length and
+    // latency histograms and rehash counters (see dnadb_stats.h)
+    DnaDbStats stats() const;
+    const Hash& getHash() const {return m_hash;}
+    void changeProbPolicy(prob_t policy);
+    // 0 (the default) migrates the entries of a resized table incrementally. With 1 or
+    // more, the resize moves every entry at once, split over that many threads when
+    // the table holds at least Policy::PARALLELMIN entries.
+    void setRehashThreads(int threads) {m_rehashThreads = threads < 0 ? 0 : threads;}
+    int getRehashThreads() const {return m_rehashThreads;}
+    // Share (0-1] of the old table each incremental transfer step moves, Policy::TRANSFERSTEP
+    // by default; a smaller share spreads a migration over more operations
+    void setTransferStep(float share) {m_transferStep = (share > 0 && share <= 1) ? share : Policy::TRANSFERSTEP;}
+    float getTransferStep() const {return m_transferStep;}
+    // Sets where tables allocated from now on are placed (see placement_t), so like a
+    // policy change it takes effect with the next resize
+    void setPlacement(placement_t placement) {m_placement = placement;}
+    placement_t getPlacement() const {return m_placement;}
+
+    // Map operations: a key is stored at most once
+    bool insert(const Key& key, const Value& value);
+    Value* find(const Key& key);
+    const Value* find(const Key& key) const;
+    bool remove(const Key& key);
+
+    // Multimap operations, hashValue must be getHash()(key). insertHashed rejects the
+    // entry if duplicate(value) is true for a stored value of the same key; the others
+    // act on the first entry of the key whose value satisfies match(value).
+    template <class Match>
+    bool insertHashed(const Key& key, const Value& value, unsigned int hashValue, Match duplicate);
+    template <class Match>
+    Value* findHashed(stat_op_t op, const Key& key, unsigned int hashValue, Match match);
+    template <class Match>
+    const Value* findHashed(stat_op_t op, const Key& key, unsigned int hashValue, Match match) const;
+    template <class Match>
+    bool removeHashed(const Key& key, unsigned int hashValue, Match match);
+
+    // Returns a read-only point-in-time view of the table. Taking it only copies the
+    // segment lists; afterwards every segment the table writes to is copied once,
+    // as long as a snapshot still references it (see SlotArray). Call it from the
+    // writer's thread; the snapshot can then be read from any thread while the table
+    // keeps changing, and be released from any thread.
+    Snapshot snapshot();
+
+    // clears tombstones of the current table in place, scanning at most budget buckets
+    // from where the previous call stopped; returns the number of freed tombstones.
+    // Meant to be called from idle time, insert and remove also call it with a small budget.
+    int purgeTombstones(int budget);
+    // clears every tombstone of the current table in place
+    int compact();
+
+    // Buckets of the current table followed by the buckets of the old table; usedSlot
+    // returns the bucket if it holds an entry, else nullptr. Hold a Cursor while
+    // reading them so that no entry moves.
+    long slotCount() const {return (long)m_currentCap + m_oldCap;}
+    const Slot* usedSlot(long slot) const;
+    // Prints every bucket of both tables, key and value need an operator<<
+    void dump() const;
+
+    private:
+    Hash       m_hash;          // hash function
+    prob_t     m_newPolicy;     // stores the change of policy request
+
+    SlotArray<Slot> m_currentTable; // hash table
+    int        m_currentCap;    // hash table size (capacity)
+    int        m_currentSize;   // current number of entries
+                                // m_currentSize includes deleted entries
+    int        m_currNumDeleted;// number of deleted entries
+    prob_t     m_currProbing;   // collision handling policy
+
+    SlotArray<Slot> m_oldTable;     // hash table
+    int        m_oldCap;        // hash table size (capacity)
+    int        m_oldSize;       // current number of entries
+                                // m_oldSize includes deleted entries
+    int        m_oldNumDeleted; // number of deleted entries
+    prob_t     m_oldProbing;    // collision handling policy
+
+    int        m_transferIndex; // used for incremental rehash
+    int        m_purgeIndex;    // next bucket checked by purgeTombstones
+    mutable long long m_numProbes; // buckets visited by inserts, lookups and transfers
+    mutable int m_numCursors;   // open cursors, they pause transfers and tombstone sweeps
+    int        m_generation;    // incremented by every rehash, invalidates open cursors
+    int        m_rehashThreads; // threads moving all entries at once on a resize, 0 for incremental
+    float      m_transferStep;  // share of the old table moved by each transfer step
+    placement_t m_placement;    // memory placement of the tables allocated by resizes
+#ifdef DNADB_STATS
+    mutable DnaDbStats m_stats;    // counters and histograms, see stats()
+    // Latency histogram of a findHashed call: lookups and updates apart, the
+    // checks made by other operations are not timed
+    Histogram* latencyOf(stat_op_t op) const {
+        return op == OP_FIND ? &m_stats.findLatency : op == OP_UPDATE ? &m_stats.updateLatency : nullptr;
+    }
+#endif
+
+    //private helper functions
+    template <class Match>
+    int findIndex(stat_op_t op, const SlotArray<Slot>& table, int cap, prob_t probing, unsigned int hashValue,
+                  const Key& key, Match match, int* step = nullptr) const;
+    template <class Match>
+    static int probeTable(const SlotArray<Slot>& table, int cap, prob_t probing, unsigned int hashValue,
+                          const Key& key, Match match, int* step, int& visited);
+    void linkPath(unsigned int hashValue, int steps);
+    void unlinkPath(unsigned int hashValue, int steps);
+    // moves the entry of from into the free bucket to, from keeps no resources
+    static void moveEntry(Slot& to, Slot& from);
+    static void clearEntry(Slot& slot);
+    void freeTombstone(Slot& slot);
+    //function to transfer elements from old to new table when the load factor is >0.5
+    void rehash();
+    //function to keep transfering nodes from the old table to the new table
+    void incrementalRehash();
+    void transferStep();
+    // moves every entry of the old table at once, see setRehashThreads
+    void transferAll(int threads);
+    // moves the used entries of old table buckets [first, last), returns the buckets probed
+    long long transferRange(int first, int last, int& moved);
+};
+
+// Walks the used entries of the current and the old table. While a cursor is open
+// the incremental transfer and the tombstone sweeps are paused, so every entry is
+// visited exactly once even in the middle of a rehash. Entries inserted meanwhile
+// may or may not be visited. A resize (grow or shrink) ends the walk: next()
+// returns false and valid() turns false.
+//
+//     Table::Cursor cursor(table);
+//     while (cursor.next()) use(cursor.get().key, cursor.get().value);
+template <class Key, class Value, class Hash, class Policy>
+class HashDb<Key, Value, Hash, Policy>::Cursor{
+    public:
+    Cursor(const HashDb& table) : m_table(table){
+        m_table.m_numCursors++;
+        m_generation = m_table.m_generation;
+        m_slot = -1;
+    }
+    ~Cursor(){m_table.m_numCursors--;}
+    Cursor(const Cursor&) = delete;
+    Cursor& operator=(const Cursor&) = delete;
+    // Moves to the next used entry, returns false at the end
+    bool next(){
+        if (!valid())
+            return false;
+        long total = m_table.slotCount();
+        while (++m_slot < total){
+            if (m_table.usedSlot(m_slot) != nullptr)
+                return true;
+        }
+        return false;
+    }
+    // The current entry, only valid after next() returned true
+    const Slot& get() const {return *m_table.usedSlot(m_slot);}
+    // False once a resize has invalidated the cursor
+    bool valid() const {return m_generation == m_table.m_generation;}
+    private:
+    const HashDb& m_table;
+    int           m_generation;  // generation of the table when the cursor was opened
+    long          m_slot;        // slot of the current entry, current table first
+};
+
+// Memory a key comparison reads besides the bucket, prefetched by Probe
+inline const void* keyMemory(const string& key){return key.data();}
+template <class Key>
+const void* keyMemory(const Key& key){return &key;}
+
+// A lookup split into steps that each read one piece of memory, for callers that
+// keep many lookups in flight and prefetch the next address of each before
+// switching to another one (see dnadb_async.h). A step reads a bucket, or the
+// stored key of a bucket whose hash matched. The table must not change while a
+// probe is in progress, and the key must outlive it.
+//
+//     Table::Probe<Match> probe(table, key, hashValue, match);
+//     do prefetch(probe.address()); while (probe.step());
+//     use(probe.found());
+template <class Key, class Value, class Hash, class Policy>
+template <class Match>
+class HashDb<Key, Value, Hash, Policy>::Probe{
+    public:
+    Probe(const HashDb& table, const Key& key, unsigned int hashValue, Match match)
+        : m_table(table), m_key(key), m_hash(hashValue), m_match(match), m_found(nullptr){
+        start(m_table.m_currentTable, m_table.m_currentCap, m_table.m_currProbing);
+    }
+    // The memory the next step() reads
+    const void* address() const {
+        return m_compareKey ? keyMemory((*m_slots)[m_index].key) : &(*m_slots)[m_index];
+    }
+    // Reads one bucket or stored key, returns false once the lookup is over
+    bool step(){
+        const Slot& slot = (*m_slots)[m_index];
+        if (!m_compareKey){
+            m_table.m_numProbes++;
+            if (slot.state == SLOT_USED && slot.hash == m_hash){
+                m_compareKey = true; // compare the keys in the next step
+                return true;
+            }
+        }
+        else{
+            m_compareKey = false;
+            if (slot.key == m_key && m_match(slot.value)){
+                m_found = &slot.value;
+                return false;
+            }
+        }
+        if (slot.state != SLOT_EMPTY && ++m_step < m_cap){
+            m_index = probeIndex(m_hash, m_step, m_cap, m_probing);
+            return true;
+        }
+        // the end of the chain, a rehash may still hold the entry in the old table
+        if (m_slots == &m_table.m_currentTable && m_table.rehashing()){
+            start(m_table.m_oldTable, m_table.m_oldCap, m_table.m_oldProbing);
+            return true;
+        }
+        return false;
+    }
+    // The value of the entry once step() returned false, nullptr if there is none
+    const Value* found() const {return m_found;}
+    private:
+    const HashDb&          m_table;
+    const SlotArray<Slot>* m_slots;   // table being probed
+    int                    m_cap;
+    prob_t                 m_probing;
+    const Key&             m_key;
+    unsigned int           m_hash;
+    Match                  m_match;
+    int                    m_step;    // probe step of the bucket at m_index
+    int                    m_index;
+    bool                   m_compareKey; // the next step compares the key of the bucket at m_index
+    const Value*           m_found;
+    void start(const SlotArray<Slot>& slots, int cap, prob_t probing){
+        m_slots = &slots;
+        m_cap = cap;
+        m_probing = probing;
+        m_step = 0;
+        m_index = probeIndex(m_hash, 0, cap, probing);
+        m_compareKey = false;
+    }
+};
+
+// Read-only point-in-time view of a HashDb, returned by HashDb::snapshot().
+// It holds references to the segments of both tables as they were when it was
+// taken; segments the table has changed since are private copies of the table.
+template <class Key, class Value, class Hash, class Policy>
+class HashDb<Key, Value, Hash, Policy>::Snapshot{
+    public:
+    const Value* find(const Key& key) const {return findHashed(key, m_hash(key), AnyValue());}
+    // hashValue must be getHash()(key), see HashDb::findHashed
+    template <class Match>
+    const Value* findHashed(const Key& key, unsigned int hashValue, Match match) const {
+        int visited = 0;
+        int index = probeTable(m_current, m_current.capacity(), m_currProbing, hashValue, key, match, nullptr, visited);
+        if (index >= 0)
+            return &m_current[index].value;
+        if (m_old.allocated()){
+            index = probeTable(m_old, m_old.capacity(), m_oldProbing, hashValue, key, match, nullptr, visited);
+            if (index >= 0)
+                return &m_old[index].value;
+        }
+        return nullptr;
+    }
+    // Returns the number of used entries
+    long size() const {return m_size;}
+    const Hash& getHash() const {return m_hash;}
+    // Same layout as HashDb::slotCount/usedSlot, no cursor is needed
+    long slotCount() const {return (long)m_current.capacity() + m_old.capacity();}
+    const Slot* usedSlot(long slot) const {
+        const Slot* bucket = (slot < m_current.capacity()) ? &m_current[slot] : &m_old[slot - m_current.capacity()];
+        return bucket->state == SLOT_USED ? bucket : nullptr;
+    }
+    private:
+    friend class HashDb;
+    Snapshot(const Hash& hash) : m_hash(hash){}
+    SlotArray<Slot> m_current;      // buckets of the current table
+    SlotArray<Slot> m_old;          // buckets of the old table, if a rehash was in progress
+    prob_t          m_currProbing;
+    prob_t          m_oldProbing;
+    long            m_size;
+    Hash            m_hash;
+};
+
+// HashDb constructor to initialize our hash table
+template <class Key, class Value, class Hash, class Policy>
+HashDb<Key, Value, Hash, Policy>::HashDb(int size, const Hash& hash, prob_t probing) : m_hash(hash){
+    // Pick the smallest table prime that holds size buckets, the result stays
+    // within the valid prime range [MINPRIME-MAXPRIME]
+    m_currentCap = findNextPrime(size);
+    // Set the initial probing policy for collision resolution
+    m_currProbing = probing;
+    // Every bucket starts empty
+    m_currentTable.allocate(m_currentCap);
+
+    // Initialize all other member variables related to table state and rehashing
+    m_currentSize = 0; // Number of active elements in the current table
+    m_currNumDeleted = 0; // Number of deleted elements in the current table
+    m_transferIndex = 0; // Tracks progress of incremental rehash
+    m_purgeIndex = 0; // Tracks progress of the tombstone sweep
+    m_numProbes = 0; // Buckets visited so far
+    m_numCursors = 0; // No cursor is open
+    m_generation = 0; // Counts rehashes, cursors stop when it changes
+    m_rehashThreads = 0; // Incremental migration
+    m_transferStep = Policy::TRANSFERSTEP; // Share moved by each incremental step
+    m_placement = PLACE_DEFAULT; // Buckets come from operator new
+    m_newPolicy = probing; // Stores the policy for the next rehash
+    m_oldCap = 0; // Capacity of the old table
+    m_oldSize = 0; // Size of the old table
+    m_oldNumDeleted = 0; // Number of deleted items in the old table
+    m_oldProbing = probing; // Probing policy of the old table
+}
+
+template <class Key, class Value, class Hash, class Policy>
+HashDb<Key, Value, Hash, Policy>::~HashDb(){
+}
+
+// Allows changing the probing policy for future rehashes
+template <class Key, class Value, class Hash, class Policy>
+void HashDb<Key, Value, Hash, Policy>::changeProbPolicy(prob_t policy){
+    m_newPolicy = policy;
+}
+
+template <class Key, class Value, class Hash, class Policy>
+bool HashDb<Key, Value, Hash, Policy>::insert(const Key& key, const Value& value){
+    return insertHashed(key, value, m_hash(key), AnyValue());
+}
+
+template <class Key, class Value, class Hash, class Policy>
+Value* HashDb<Key, Value, Hash, Policy>::find(const Key& key){
+    return findHashed(OP_FIND, key, m_hash(key), AnyValue());
+}
+
+template <class Key, class Value, class Hash, class Policy>
+const Value* HashDb<Key, Value, Hash, Policy>::find(const Key& key) const{
+    return findHashed(OP_FIND, key, m_hash(key), AnyValue());
+}
+
+template <class Key, class Value, class Hash, class Policy>
+bool HashDb<Key, Value, Hash, Policy>::remove(const Key& key){
+    return removeHashed(key, m_hash(key), AnyValue());
+}
+
+// Inserts an entry using a precomputed hash value
+template <class Key, class Value, class Hash, class Policy>
+template <class Match>
+bool HashDb<Key, Value, Hash, Policy>::insertHashed(const Key& key, const Value& value, unsigned int hashValue, Match duplicate){
+    DNADB_STAT(StatTimer timer(m_stats.insertLatency));
+    // While a rehash is in progress the entry may still live in the old table
+    if (rehashing() &&
+        findIndex(OP_INSERT, m_oldTable, m_oldCap, m_oldProbing, hashValue, key, duplicate) >= 0){
+        return false;
+    }
+
+    // Probe until an empty bucket ends the chain, rejecting duplicates on the way
+    // and remembering the first deleted bucket as the place to insert
+    int index = -1;
+    int step = 0;
+    int freeIndex = -1;
+    int freeStep = 0;
+    DNADB_STAT(long long probes = m_numProbes);
+    for (int i = 0; i < m_currentCap; i++){
+        index = probeIndex(hashValue, i, m_currentCap, m_currProbing);
+        m_numProbes++;
+        const Slot& slot = m_currentTable[index];
+        if (slot.state == SLOT_EMPTY){
+            step = i;
+            break;
+        }
+        if (slot.state == SLOT_USED){
+            // If the entry already exists, return false
+            if (slot.hash == hashValue && slot.key == key && duplicate(slot.value))
+                return false;
+        }
+        else if (freeIndex < 0){
+            freeIndex = index;
+            freeStep = i;
+        }
+    }
+    DNADB_STAT(m_stats.probeHist[OP_INSERT][CURRTABLE].record(m_numProbes - probes));
+    if (freeIndex >= 0){
+        index = freeIndex;
+        step = freeStep;
+    }
+    else if (m_currentTable[index].state != SLOT_EMPTY){
+        return false; // no free bucket on the probe sequence
+    }
+
+    // Fill an empty bucket or overwrite a previously deleted one
+    Slot& slot = m_currentTable.writable(index);
+    if (slot.state == SLOT_EMPTY)
+        m_currentSize++; // Increment the count of occupied buckets
+    else
+        m_currNumDeleted--; // A deleted bucket is already counted in m_currentSize
+    slot.key = key;
+    slot.value = value;
+    slot.hash = hashValue;
+    slot.state = SLOT_USED;
+    linkPath(hashValue, step);
+
+    // Check load factor and grow the table, or clear the tombstones in place
+    // if they are what pushes the load factor over the limit
+    if (lambda() > Policy::MAXLOAD){
+        if (m_currentSize - m_currNumDeleted <= Policy::GROWLOAD * m_currentCap && !rehashing()){
+            compact();
+        }
+        if (lambda() > Policy::MAXLOAD){
+            rehash(); // Perform a full rehash to a larger table
+        }
+        incrementalRehash(); // Start incremental transfer if rehashing is in progress
+    }
+    // If a rehash is already in progress, continue incremental transfer
+    else if (rehashing()){
+        incrementalRehash();
+    }
+    // Otherwise use the operation to clear a few tombstones
+    else if (m_currNumDeleted > 0){
+        purgeTombstones(Policy::PURGESTEP);
+    }
+
+    return true;
+}
+
+// Removes an entry from either table
+template <class Key, class Value, class Hash, class Policy>
+template <class Match>
+bool HashDb<Key, Value, Hash, Policy>::removeHashed(const Key& key, unsigned int hashValue, Match match){
+    // Look in the current table first
+    int step = 0;
+    int index = findIndex(OP_REMOVE, m_currentTable, m_currentCap, m_currProbing, hashValue, key, match, &step);
+    if (index >= 0){
+        unlinkPath(hashValue, step);
+        Slot& slot = m_currentTable.writable(index);
+        clearEntry(slot);
+        // The bucket only has to stay as a tombstone if other chains run through it
+        if (slot.passing == 0){
+            slot.state = SLOT_EMPTY;
+            m_currentSize--;
+        }
+        else{
+            slot.state = SLOT_DELETED; // Mark as logically deleted
+            m_currNumDeleted++; // Increment deleted count
+        }
+        int live = m_currentSize - m_currNumDeleted;
+        // Shrink a mostly empty table, clear tombstones in place if they pile up
+        if (!rehashing() && live < Policy::SHRINKLOAD * m_currentCap && findNextPrime(4LL * live) < m_currentCap){
+            rehash();
+        }
+        else if ((float)m_currNumDeleted > Policy::MAXDELETED * m_currentSize){
+            compact();
+        }
+        else if (!rehashing() && m_currNumDeleted > 0){
+            purgeTombstones(Policy::PURGESTEP); // Clear a few tombstones while there is no migration
+        }
+        incrementalRehash(); // Continue incremental rehash if active
+        return true; // entry successfully removed
+    }
+
+    // If not found in the current table, check the old table if a rehash is in progress
+    if (rehashing()){
+        index = findIndex(OP_REMOVE, m_oldTable, m_oldCap, m_oldProbing, hashValue, key, match);
+        if (index >= 0){
+            Slot& slot = m_oldTable.writable(index);
+            clearEntry(slot);
+            slot.state = SLOT_DELETED; // Mark as logically deleted in old table
+            m_oldNumDeleted++; // Increment old table's deleted count
+            incrementalRehash(); // Continue incremental rehash
+            return true; // entry successfully marked for deletion
+        }
+    }
+
+    return false; // entry not found or not deleted
+}
+
+// Returns the value of a stored entry, or nullptr. The key is not part of the
+// value, so the caller may change the value in place.
+template <class Key, class Value, class Hash, class Policy>
+template <class Match>
+Value* HashDb<Key, Value, Hash, Policy>::findHashed(stat_op_t op, const Key& key, unsigned int hashValue, Match match){
+    DNADB_STAT(StatTimer timer(latencyOf(op)));
+    int index = findIndex(op, m_currentTable, m_currentCap, m_currProbing, hashValue, key, match);
+    if (index >= 0)
+        return &m_currentTable.writable(index).value;
+    if (rehashing()){
+        index = findIndex(op, m_oldTable, m_oldCap, m_oldProbing, hashValue, key, match);
+        if (index >= 0)
+            return &m_oldTable.writable(index).value;
+    }
+    return nullptr;
+}
+
+template <class Key, class Value, class Hash, class Policy>
+template <class Match>
+const Value* HashDb<Key, Value, Hash, Policy>::findHashed(stat_op_t op, const Key& key, unsigned int hashValue, Match match) const{
+    DNADB_STAT(StatTimer timer(latencyOf(op)));
+    // Scan the current table for the entry
+    int index = findIndex(op, m_currentTable, m_currentCap, m_currProbing, hashValue, key, match);
+    if (index >= 0)
+        return &m_currentTable[index].value;
+
+    // If not found in the current table, check the old table if a rehash is in progress
+    if (rehashing()){
+        index = findIndex(op, m_oldTable, m_oldCap, m_oldProbing, hashValue, key, match);
+        if (index >= 0)
+            return &m_oldTable[index].value;
+    }
+    return nullptr;
+}
+
+// Returns the bucket holding the used entry with the given key and matching value, or -1.
+// The search ends at the first empty bucket, step receives the probe step of the match
+// and visited the number of buckets looked at.
+template <class Key, class Value, class Hash, class Policy>
+template <class Match>
+int HashDb<Key, Value, Hash, Policy>::probeTable(const SlotArray<Slot>& table, int cap, prob_t probing, unsigned int hashValue,
+                                                 const Key& key, Match match, int* step, int& visited){
+    int found = -1;
+    int i = 0;
+    while (i < cap){
+        int index = probeIndex(hashValue, i, cap, probing);
+        i++;
+        const Slot& slot = table[index];
+        if (slot.state == SLOT_EMPTY)
+            break;
+        // the stored hash rules out most other keys without comparing them
+        if (slot.state == SLOT_USED && slot.hash == hashValue && slot.key == key && match(slot.value)){
+            if (step) *step = i - 1;
+            found = index;
+            break;
+        }
+    }
+    visited = i;
+    return found;
+}
+
+// probeTable on one of our tables, counting the probes
+template <class Key, class Value, class Hash, class Policy>
+template <class Match>
+int HashDb<Key, Value, Hash, Policy>::findIndex(stat_op_t op, const SlotArray<Slot>& table, int cap, prob_t probing, unsigned int hashValue,
+                                                const Key& key, Match match, int* step) const{
+    (void)op; // only used by the statistics
+    int visited = 0;
+    int found = probeTable(table, cap, probing, hashValue, key, match, step, visited);
+    m_numProbes += visited;
+    DNADB_STAT(m_stats.probeHist[op][&table == &m_oldTable ? OLDTABLE : CURRTABLE].record(visited));
+    return found;
+}
+
+// Counts a chain of the current table as running through its first steps buckets
+template <class Key, class Value, class Hash, class Policy>
+void HashDb<Key, Value, Hash, Policy>::linkPath(unsigned int hashValue, int steps){
+    for (int i = 0; i < steps; i++){
+        m_currentTable.writable(probeIndex(hashValue, i, m_currentCap, m_currProbing)).passing++;
+    }
+}
+
+// Undoes linkPath; tombstones that no chain runs through anymore become empty buckets
+template <class Key, class Value, class Hash, class Policy>
+void HashDb<Key, Value, Hash, Policy>::unlinkPath(unsigned int hashValue, int steps){
+    for (int i = 0; i < steps; i++){
+        Slot& slot = m_currentTable.writable(probeIndex(hashValue, i, m_currentCap, m_currProbing));
+        slot.passing--;
+        if (slot.passing == 0 && slot.state == SLOT_DELETED)
+            freeTombstone(slot);
+    }
+}
+
+template <class Key, class Value, class Hash, class Policy>
+void HashDb<Key, Value, Hash, Policy>::moveEntry(Slot& to, Slot& from){
+    to.key = std::move(from.key);
+    to.value = std::move(from.value);
+    to.hash = from.hash;
+    to.state = SLOT_USED;
+    clearEntry(from);
+}
+
+// Releases whatever the key and value of a bucket hold
+template <class Key, class Value, class Hash, class Policy>
+void HashDb<Key, Value, Hash, Policy>::clearEntry(Slot& slot){
+    slot.key = Key();
+    slot.value = Value();
+}
+
+// Turns a tombstone of the current table back into an empty bucket
+template <class Key, class Value, class Hash, class Policy>
+void HashDb<Key, Value, Hash, Policy>::freeTombstone(Slot& slot){
+    slot.state = SLOT_EMPTY;
+    m_currNumDeleted--;
+    m_currentSize--;
+}
+
+// Sweeps up to budget buckets of the current table, starting where the last call stopped.
+// Every used entry found is moved to the first tombstone of its own probe sequence, if
+// there is one, which shortens its chain; tombstones no chain runs through anymore are freed.
+// Lookups stay correct after every single move, so the sweep can stop at any point.
+template <class Key, class Value, class Hash, class Policy>
+int HashDb<Key, Value, Hash, Policy>::purgeTombstones(int budget){
+    // Moving entries would make open cursors miss or repeat them
+    if (m_numCursors > 0)
+        return 0;
+    int before = m_currNumDeleted;
+    for (int n = 0; n < budget && m_currNumDeleted > 0; n++){
+        int index = m_purgeIndex;
+        m_purgeIndex = (m_purgeIndex + 1) % m_currentCap;
+        if (m_currentTable[index].state != SLOT_USED)
+            continue;
+
+        unsigned int hashValue = m_currentTable[index].hash;
+        // Find the first tombstone in front of the entry on its probe sequence
+        int freeIndex = -1;
+        int freeStep = 0;
+        int step = 0;
+        while (true){
+            int probe = probeIndex(hashValue, step, m_currentCap, m_currProbing);
+            if (probe == index)
+                break;
+            if (freeIndex < 0 && m_currentTable[probe].state == SLOT_DELETED){
+                freeIndex = probe;
+                freeStep = step;
+            }
+            step++;
+        }
+        if (freeIndex < 0)
+            continue;
+
+        // Move the entry into the tombstone, the chain now ends at freeStep
+        Slot& tombstone = m_currentTable.writable(freeIndex);
+        Slot& entry = m_currentTable.writable(index);
+        moveEntry(tombstone, entry);
+        entry.state = SLOT_DELETED;
+        tombstone.passing--;
+        for (int i = freeStep + 1; i < step; i++){
+            Slot& slot = m_currentTable.writable(probeIndex(hashValue, i, m_currentCap, m_currProbing));
+            slot.passing--;
+            if (slot.passing == 0 && slot.state == SLOT_DELETED)
+                freeTombstone(slot);
+        }
+        if (entry.passing == 0)
+            freeTombstone(entry);
+    }
+    DNADB_STAT(m_stats.purgedTombstones += before - m_currNumDeleted);
+    return before - m_currNumDeleted;
+}
+
+// Clears every tombstone of the current table without reallocating it.
+// A tombstone is only kept while some chain runs through it, and that chain is
+// shortened when the sweep reaches its entry, so repeated sweeps always finish.
+template <class Key, class Value, class Hash, class Policy>
+int HashDb<Key, Value, Hash, Policy>::compact(){
+    int purged = 0;
+    while (m_currNumDeleted > 0 && m_numCursors == 0){
+        purged += purgeTombstones(m_currentCap);
+    }
+    return purged;
+}
+
+template <class Key, class Value, class Hash, class Policy>
+typename HashDb<Key, Value, Hash, Policy>::Snapshot HashDb<Key, Value, Hash, Policy>::snapshot(){
+    Snapshot view(m_hash);
+    view.m_current = m_currentTable.share();
+    view.m_old = m_oldTable.share();
+    view.m_currProbing = m_currProbing;
+    view.m_oldProbing = m_oldProbing;
+    view.m_size = size();
+    return view;
+}
+
+template <class Key, class Value, class Hash, class Policy>
+long HashDb<Key, Value, Hash, Policy>::size() const {
+    return (long)m_currentSize - m_currNumDeleted + m_oldSize - m_oldNumDeleted;
+}
+
+// Returns a snapshot of the gauges and, when built with DNADB_STATS, of all counters
+template <class Key, class Value, class Hash, class Policy>
+DnaDbStats HashDb<Key, Value, Hash, Policy>::stats() const {
+    DnaDbStats snapshot;
+#ifdef DNADB_STATS
+    snapshot = m_stats;
+    snapshot.enabled = true;
+#endif
+    snapshot.capacity = m_currentCap;
+    snapshot.size = m_currentSize;
+    snapshot.deleted = m_currNumDeleted;
+    snapshot.oldCapacity = m_oldCap;
+    snapshot.oldSize = m_oldSize;
+    snapshot.probes = m_numProbes;
+    return snapshot;
+}
+
+// Calculates the load factor of the current hash table
+template <class Key, class Value, class Hash, class Policy>
+float HashDb<Key, Value, Hash, Policy>::lambda() const {
+    return (float)m_currentSize / (float)m_currentCap;
+}
+
+// Calculates the ratio of deleted items to active items in the current hash table
+template <class Key, class Value, class Hash, class Policy>
+float HashDb<Key, Value, Hash, Policy>::deletedRatio() const {
+    return (float)m_currNumDeleted / (float)m_currentSize;
+}
+
+// Returns the bucket of the concatenated current and old tables if it holds an entry
+template <class Key, class Value, class Hash, class Policy>
+const typename HashDb<Key, Value, Hash, Policy>::Slot* HashDb<Key, Value, Hash, Policy>::usedSlot(long slot) const {
+    const Slot* bucket = (slot < m_currentCap) ? &m_currentTable[slot] : &m_oldTable[slot - m_currentCap];
+    return bucket->state == SLOT_USED ? bucket : nullptr;
+}
+
+// Prints the contents of both the current and old hash tables
+template <class Key, class Value, class Hash, class Policy>
+void HashDb<Key, Value, Hash, Policy>::dump() const {
+    // '\n' instead of endl, flushing every line makes large dumps very slow
+    cout << "Dump for the current table: " << '\n';
+    for (int i = 0; i < m_currentCap; i++) {
+        cout << "[" << i << "] : ";
+        if (m_currentTable[i].state == SLOT_USED)
+            cout << m_currentTable[i].key << " (" << m_currentTable[i].value << ", 1)";
+        else if (m_currentTable[i].state == SLOT_DELETED)
+            cout << "(deleted)";
+        cout << '\n';
+    }
+    cout << "Dump for the old table: " << '\n';
+    for (int i = 0; i < m_oldCap; i++) {
+        cout << "[" << i << "] : ";
+        if (m_oldTable[i].state == SLOT_USED)
+            cout << m_oldTable[i].key << " (" << m_oldTable[i].value << ", 1)";
+        else if (m_oldTable[i].state == SLOT_DELETED)
+            cout << "(deleted)";
+        cout << '\n';
+    }
+    cout << flush;
+}
+
+// Initiates a rehash operation, creating a new, larger table
+template <class Key, class Value, class Hash, class Policy>
+void HashDb<Key, Value, Hash, Policy>::rehash(){
+    // Finish a migration that is still in progress before starting another one
+    while (rehashing()){
+        transferStep();
+    }
+    m_generation++; // open cursors cannot follow the entries anymore
+
+    DNADB_STAT(StatClock clock(m_stats.rehashNanos));
+    DNADB_STAT(m_stats.rehashes++);
+
+    // Determine the new capacity (next table prime after 4 times the number of active elements)
+    int newCap = findNextPrime(4LL * (m_currentSize - m_currNumDeleted));
+
+    // Move the current table to the 'old' table state for incremental rehashing
+    m_oldTable = std::move(m_currentTable);
+    m_oldCap = m_currentCap;
+    m_oldSize = m_currentSize;
+    m_oldNumDeleted = m_currNumDeleted;
+    m_oldProbing = m_currProbing;
+
+    // Set up the new table as the current table
+    m_currentTable.allocate(newCap, m_placement);
+    m_currentCap = newCap;
+    m_currentSize = 0; // Reset current size as items will be transferred
+    m_currNumDeleted = 0; // Reset deleted count for the new table
+    m_currProbing = m_newPolicy; // Apply the new probing policy
+
+    m_transferIndex = 0; // Reset the transfer index for incremental rehash
+    m_purgeIndex = 0; // Restart the tombstone sweep on the new table
+
+    if (m_rehashThreads > 0)
+        transferAll(m_rehashThreads);
+}
+
+// Performs incremental rehash, moving a portion of elements from the old to the new table
+template <class Key, class Value, class Hash, class Policy>
+void HashDb<Key, Value, Hash, Policy>::incrementalRehash() {
+    // Return if there's no old table to rehash from, or if open cursors pin the entries
+    if (!rehashing() || m_numCursors > 0) {
+        return;
+    }
+    transferStep();
+}
+
+// Moves the next share of the old table's buckets to the new table
+template <class Key, class Value, class Hash, class Policy>
+void HashDb<Key, Value, Hash, Policy>::transferStep() {
+
+    DNADB_STAT(StatClock clock(m_stats.rehashNanos));
+    DNADB_STAT(m_stats.migrationSteps++);
+
+    // Determine how many buckets to transfer in this increment
+    int transferCount = std::max(1, (int)std::floor(m_oldCap * m_transferStep));
+    // Iterate through a segment of the old table
+    for (int i = 0; i < transferCount; ++i) {
+        int index = (m_transferIndex + i) % m_oldCap; // Calculate index in old table
+        // Empty buckets and buckets handled by an earlier pass are skipped
+        if (m_oldTable[index].state == SLOT_EMPTY || m_oldTable[index].state == SLOT_MOVED) {
+            continue;
+        }
+        Slot& old = m_oldTable.writable(index);
+        // Used entries are rehashed into the new table, probing for the first empty or deleted bucket
+        if (old.state == SLOT_USED) {
+            unsigned int hashValue = old.hash;
+            int step = 0;
+            int newIndex = probeIndex(hashValue, step, m_currentCap, m_currProbing);
+            m_numProbes++;
+            while (m_currentTable[newIndex].state == SLOT_USED) {
+                m_numProbes++;
+                step++;
+                newIndex = probeIndex(hashValue, step, m_currentCap, m_currProbing);
+            }
+            Slot& slot = m_currentTable.writable(newIndex);
+            if (slot.state == SLOT_DELETED)
+                m_currNumDeleted--; // A deleted bucket in the new table is reused
+            else
+                m_currentSize++; // Increment current table's size
+            moveEntry(slot, old);
+            linkPath(hashValue, step);
+            DNADB_STAT(m_stats.migratedEntries++);
+        }
+        // Deleted buckets are not transferred
+        else {
+            m_oldNumDeleted--;
+        }
+        // The bucket may still be part of another chain of the old table, so it
+        // becomes a marker instead of an empty bucket
+        old.state = SLOT_MOVED;
+        m_oldSize--; // Decrement old table's size
+    }
+
+    // Update the starting index for the next incremental transfer
+    m_transferIndex = (m_transferIndex + transferCount) % m_oldCap;
+
+    // If all elements from the old table have been transferred, deallocate the old table
+    if (m_oldSize == 0) {
+        m_oldTable.release();
+        m_oldCap = 0;
+    }
+}
+
+// Moves the whole old table in one go. The old buckets are split into contiguous
+// ranges, one per thread; the threads claim buckets of the new table with a
+// compare-and-swap on the state, so they never need a lock. The new table has just
+// been allocated, it holds no tombstones and no snapshot shares its segments.
+template <class Key, class Value, class Hash, class Policy>
+void HashDb<Key, Value, Hash, Policy>::transferAll(int threads) {
+    DNADB_STAT(m_stats.migrationSteps++);
+    // Copy the segments still shared with snapshots now, the threads move the keys out
+    for (long first = 0; first < m_oldCap; first += SEGMENTSLOTS)
+        m_oldTable.writable(first);
+    if (m_oldSize - m_oldNumDeleted < Policy::PARALLELMIN)
+        threads = 1;
+
+    vector<int> moved(threads, 0);
+    vector<long long> probes(threads, 0);
+    vector<thread> workers;
+    for (int t = 1; t < threads; t++){
+        int first = (int)((long long)m_oldCap * t / threads);
+        int last = (int)((long long)m_oldCap * (t + 1) / threads);
+        workers.push_back(thread([this, first, last, t, &moved, &probes]{
+            probes[t] = transferRange(first, last, moved[t]);
+        }));
+    }
+    probes[0] = transferRange(0, (int)((long long)m_oldCap / threads), moved[0]);
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+
+    for (int t = 0; t < threads; t++){
+        m_currentSize += moved[t];
+        m_numProbes += probes[t];
+        DNADB_STAT(m_stats.migratedEntries += moved[t]);
+    }
+    m_oldTable.release();
+    m_oldCap = 0;
+    m_oldSize = 0;
+    m_oldNumDeleted = 0;
+}
+
+template <class Key, class Value, class Hash, class Policy>
+long long HashDb<Key, Value, Hash, Policy>::transferRange(int first, int last, int& moved) {
+    long long probes = 0;
+    for (int index = first; index < last; index++) {
+        if (m_oldTable[index].state != SLOT_USED)
+            continue;
+        Slot& old = m_oldTable.writable(index);
+        unsigned int hashValue = old.hash;
+        // the first empty bucket on the probe sequence that no other thread took first
+        int step = 0;
+        int newIndex = 0;
+        for (; step < m_currentCap; step++) {
+            newIndex = probeIndex(hashValue, step, m_currentCap, m_currProbing);
+            probes++;
+            unsigned char* state = &m_currentTable.writable(newIndex).state;
+            unsigned char expected = SLOT_EMPTY;
+            if (__atomic_load_n(state, __ATOMIC_RELAXED) == SLOT_EMPTY &&
+                __atomic_compare_exchange_n(state, &expected, (unsigned char)SLOT_USED, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+                break;
+        }
+        // the state is already SLOT_USED, the other threads only ever read the state
+        Slot& slot = m_currentTable.writable(newIndex);
+        slot.key = std::move(old.key);
+        slot.value = std::move(old.value);
+        slot.hash = hashValue;
+        clearEntry(old);
+        for (int i = 0; i < step; i++)
+            __atomic_fetch_add(&m_currentTable.writable(probeIndex(hashValue, i, m_currentCap, m_currProbing)).passing,
+                               1, __ATOMIC_RELAXED);
+        moved++;
+    }
+    return probes;
+}
+#endif
@@ -0,0 +1,117 @@
+#ifndef HASHDB_PLACEMENT_H
+#define HASHDB_PLACEMENT_H
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+// Where the bucket arrays of a HashDb live (see HashDb::setPlacement). The modes
+// are bit flags, PLACE_HUGEPAGES | PLACE_INTERLEAVE uses both.
+//   PLACE_DEFAULT    - operator new, pages land on the node of the first thread that writes them
+//   PLACE_HUGEPAGES  - 2 MB pages (MAP_HUGETLB, else transparent huge pages), fewer TLB misses
+//   PLACE_INTERLEAVE - pages spread round-robin over all NUMA nodes, so threads on
+//                      every node see the same average latency instead of one node paying remote
+enum placement_t {PLACE_DEFAULT = 0, PLACE_HUGEPAGES = 1, PLACE_INTERLEAVE = 2};
+inline placement_t operator|(placement_t lhs, placement_t rhs){return (placement_t)((int)lhs | (int)rhs);}
+
+const size_t HUGEPAGESIZE = 2 << 20;
+const int MAXNUMANODES = 64;
+const int MPOLINTERLEAVE = 3;       // MPOL_INTERLEAVE of <numaif.h>, used without libnuma
+
+// Bit mask of the online NUMA nodes, from a list like "0-1,3"; 0 if it cannot be read
+inline unsigned long long onlineNumaNodes(){
+    unsigned long long mask = 0;
+    FILE* file = fopen("/sys/devices/system/node/online", "r");
+    if (file == nullptr)
+        return 0;
+    int first, last;
+    char separator;
+    while (fscanf(file, "%d", &first) == 1){
+        last = first;
+        if (fscanf(file, "%c", &separator) == 1 && separator == '-'){
+            if (fscanf(file, "%d", &last) != 1) break;
+            if (fscanf(file, "%c", &separator) != 1) separator = '\n';
+        }
+        for (int node = first; node <= last && node < MAXNUMANODES; node++)
+            mask |= 1ULL << node;
+        if (separator != ',')
+            break;
+    }
+    fclose(file);
+    return mask;
+}
+
+// Maps bytes of zeroed memory placed as requested, mapped receives the length to unmap.
+// Placement is best effort: what the system does not support is skipped. nullptr on failure.
+inline void* placedAlloc(size_t bytes, placement_t placement, size_t& mapped){
+#ifdef __linux__
+    void* memory = MAP_FAILED;
+    mapped = bytes;
+    if (placement & PLACE_HUGEPAGES){
+        mapped = (bytes + HUGEPAGESIZE - 1) / HUGEPAGESIZE * HUGEPAGESIZE;
+        // reserved huge pages first, they exist only if the administrator set some aside
+        memory = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (memory == MAP_FAILED){
+            memory = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory != MAP_FAILED)
+                madvise(memory, mapped, MADV_HUGEPAGE);
+        }
+    }
+    else
+        memory = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return nullptr;
+    // the policy decides where each page goes when it is first written, so it is set before
+    unsigned long long nodes = onlineNumaNodes();
+    if ((placement & PLACE_INTERLEAVE) && (nodes & (nodes - 1)) != 0)
+        syscall(SYS_mbind, memory, mapped, MPOLINTERLEAVE, &nodes, MAXNUMANODES + 1, 0);
+    return memory;
+#else
+    (void)placement;
+    mapped = bytes;
+    return calloc(1, bytes);
+#endif
+}
+
+inline void placedFree(void* memory, size_t mapped){
+#ifdef __linux__
+    munmap(memory, mapped);
+#else
+    (void)mapped;
+    free(memory);
+#endif
+}
+
+// One placed block holding the buckets of a whole SlotArray, so huge pages can span
+// segments. Every segment keeps the arena alive; it is unmapped with the last one.
+template <class Slot>
+class SlotArena{
+    public:
+    SlotArena(long count, placement_t placement) : m_count(0), m_mapped(0){
+        m_slots = (Slot*)placedAlloc(count * sizeof(Slot), placement, m_mapped);
+        if (m_slots == nullptr)
+            return;
+        for (; m_count < count; m_count++)
+            new (m_slots + m_count) Slot();
+    }
+    ~SlotArena(){
+        for (long i = 0; i < m_count; i++)
+            m_slots[i].~Slot();
+        if (m_slots != nullptr)
+            placedFree(m_slots, m_mapped);
+    }
+    SlotArena(const SlotArena&) = delete;
+    SlotArena& operator=(const SlotArena&) = delete;
+    Slot* slots() const {return m_slots;}
+    private:
+    Slot*  m_slots;
+    long   m_count;     // constructed buckets
+    size_t m_mapped;    // bytes to unmap
+};
+#endif